@@ -20,6 +20,8 @@
 #define __APPROXIMATE_MIN_COST_FLOW__
 
 #include "data_generator.h"
+#include "thread_pool.h"
+#include "stats.h"
 
 #include <cmath>
 #include <vector>
@@ -30,6 +32,7 @@
 #include <assert.h>
 #include <time.h>
 #include <cstring>
+#include <random>
 
 using namespace std;
 
@@ -50,71 +53,149 @@ bool compareSelectedUser(const pair<int,int>& p1, const pair<int,int>& p2) {
 
 //the notation in this file is slightly inconsistent with those in other files.
 
+// The object is a reusable workspace: the users are a shared
+// UserLabelIndex, not copied, and the per-pass scratch is sized to the
+// instance.  setPricing() prepares the next evaluation.  Random round
+// i shuffles with its own mt19937_64 seeded by seed + i, so a revenue only
+// depends on the seed, and with a pool the rounds run concurrently on one
+// scratch per thread.
+
+// state of one greedy pass
+struct PassScratch {
+    // users of every label still available: those of label l are
+    // label_user_list[users->labelFirst()[l]] .. label_user_list[label_end[l]-1]
+    vector<int> label_user_list;
+    vector<unsigned long long> label_end;
+    vector<int> used_users; // used_users[u] == pass iff u is used in this pass
+    int pass;
+    vector<int> satisfiable_count; // satisfiable labels of every user at the current request
+    
+    PassScratch() : pass(0) {}
+};
+
 struct ApproximateAlgorithm {
-    vector<User> users;
-    vector<Request> requests;
+    shared_ptr<const UserLabelIndex> users; // N users and the users of every label
+    vector<Request> requests; // sorted by compareRequest
     vector<int> pricing;
     int N; // number of users;
     int M; // number of requests;
     int L; // number of labels;
-    vector<vector<int> > label_user_list;
-    bool used_users[MAX_USER];
-    bool satisfiable_labels[MAX_BUYER][MAX_LABEL]; //satisfiable_labels[i][j] denote after i-th buyer (included), whether any label will be used.
+    vector<PassScratch> scratch; // one per thread
+    // label l is still satisfiable at request k iff last_request[l] >= k
+    vector<int> last_request; // last request of every label, -1 if none
+    vector<vector<int> > expiring; // expiring[k]: labels whose last request is k
+    vector<int> initial_count; // satisfiable labels of every user at request 0
+    vector<int> price_first, price_pos; // labels of user u by decreasing price are
+    vector<int> price_labels;          // price_labels[price_pos[u]] .. [price_first[u+1]-1]
+    int rounds; // random selection rounds per revenue
+    unsigned long long seed;
+    ThreadPool* pool; // runs the rounds, NULL for sequential
     
-    ApproximateAlgorithm(const vector<User>& users, const vector<Request>& requests, const vector<int>& pricing) {
-        setParameters(users, requests, pricing);
-        srand(unsigned(time(0)));
+    // the random rounds are seeded from the instance, so revenues are
+    // reproducible; setRandomRounds() picks another seed
+    ApproximateAlgorithm(const vector<User>& users, const vector<Request>& requests, const vector<int>& pricing, unsigned long long seed = 0) {
+        setParameters(make_shared<UserLabelIndex>(users, pricing.size()), requests, pricing);
+        setRandomRounds(10, seed);
     }
     
     ApproximateAlgorithm(const NetworkData& data, const vector<int>& pricing) {
-        users = data.users;
-        requests = data.requests;
-        this->pricing = pricing;
-        N = data.M; //************ not bug!!!!! because of wrong notations
-        M = data.N; //************ not bug!!!!! because of wrong notations
-        L = data.L;
-        srand(unsigned(time(0)));
+        setParameters(data.user_index, data.requests, pricing);
+        setRandomRounds(10, data.seed);
     }
     
-    ApproximateAlgorithm() {}
+    ApproximateAlgorithm() : N(0), M(0), L(0) {
+        setRandomRounds(10, 0);
+    }
     
-    void setParameters(const vector<User>& users, const vector<Request>& requests, const vector<int>& pricing) {
+    void setParameters(shared_ptr<const UserLabelIndex> users, const vector<Request>& requests, const vector<int>& pricing) {
         this->users = users;
         this->requests = requests;
-        this->pricing = pricing;
-        N = users.size();
+        N = users->M;
         M = requests.size();
         L = pricing.size();
+        setPricing(pricing);
         
-        assert(L<=MAX_LABEL);
-        assert(M<=MAX_BUYER);
-        assert(N<=MAX_USER);
-    }
-    
-    void _init() {
-        // remap user
-        label_user_list.clear();
-        for (int i = 0; i < L; ++i) {
-            label_user_list.push_back(vector<int> (0));
-        }
-        for (int i = 0; i < N; ++i) {
-            for (const auto& l : users[i]) {
-                label_user_list[l].push_back(i);
-            }
-        }
+        assert(L<=65536); // labels are unsigned short
+        assert(users->L == L);
         
-        sort(requests.begin(), requests.end(), compareRequest);
+        // everything below only depends on the instance
+        scratch.assign(1, PassScratch());
         
-        memset(used_users, 0, sizeof(bool) * N);
+        sort(this->requests.begin(), this->requests.end(), compareRequest);
         
-        for (int i = 0; i < M; ++i) {
-            memset(satisfiable_labels[i], 0, sizeof(bool) * L);
-            for (int j = i; j < M; ++j) {
-                int l = get<0>(requests[j]);
-                satisfiable_labels[i][l] = 1;
+        last_request.assign(L, -1);
+        for (int k = M - 1; k >= 0; --k) {
+            int l = get<0>(this->requests[k]);
+            if (last_request[l] == -1) last_request[l] = k;
+        }
+        expiring.assign(M, vector<int>(0));
+        initial_count.assign(N, 0);
+        for (int l = 0; l < L; ++l) {
+            if (last_request[l] == -1) continue;
+            expiring[last_request[l]].push_back(l);
+            for (const int* u = users->labelBegin(l); u != users->labelEnd(l); ++u) {
+                initial_count[*u]++;
             }
         }
-        
+    }
+    
+    void setRandomRounds(int rounds, unsigned long long seed, ThreadPool* pool = NULL) {
+        this->rounds = rounds;
+        this->seed = seed;
+        this->pool = pool;
+    }
+    
+    void setPricing(const vector<int>& pricing) {
+        assert(L == 0 || int(pricing.size()) == L);
+        this->pricing = pricing;
+    }
+    
+    PassScratch& _init(int worker = 0) {
+        // restore the label lists and release all users, only allocating
+        // on the first pass of a worker
+        PassScratch& S = scratch[worker];
+        S.label_user_list.assign(users->labelUsers().begin(), users->labelUsers().end());
+        S.label_end.assign(users->labelFirst().begin() + 1, users->labelFirst().end());
+        if (S.used_users.size() != N) S.used_users.assign(N, 0);
+        S.satisfiable_count = initial_count;
+        S.pass++;
+        return S;
+    }
+    
+    void _expireLabels(int k, PassScratch& S) {
+        // the labels whose last request was k-1 are no longer satisfiable for
+        // the users still available on them; used users are never asked again
+        if (k == 0) return;
+        for (const auto& l : expiring[k-1]) {
+            for (unsigned long long i = users->labelFirst()[l]; i < S.label_end[l]; ++i) {
+                S.satisfiable_count[S.label_user_list[i]]--;
+            }
+        }
+    }
+    
+    void _sortLabelsByPrice() {
+        price_first.assign(N + 1, 0);
+        price_labels.clear();
+        for (int u = 0; u < N; ++u) {
+            price_labels.insert(price_labels.end(), users->begin(u), users->end(u));
+            price_first[u + 1] = price_labels.size();
+            sort(price_labels.begin() + price_first[u], price_labels.end(),
+                 [this](int a, int b) { return pricing[a] > pricing[b]; });
+        }
+        price_pos.assign(price_first.begin(), price_first.end() - 1);
+    }
+    
+    int _maxOtherPrice(int u, int l, int k) {
+        // highest price of a label of u other than l that is still satisfiable
+        // at request k; expired labels in front are skipped for good
+        while (price_pos[u] < price_first[u + 1] && last_request[price_labels[price_pos[u]]] < k) {
+            price_pos[u]++;
+        }
+        for (int i = price_pos[u]; i < price_first[u + 1]; ++i) {
+            int label = price_labels[i];
+            if (label != l && last_request[label] >= k) return pricing[label];
+        }
+        return 0;
     }
     
     int computeRevenue() {
@@ -122,9 +203,19 @@ struct ApproximateAlgorithm {
         int r1 = 0;
         int r2 = _computeRevenueWithLeastLabels();
         int r3 = 0;
-        for (int i = 0; i < 10; i++) {
-            int r = _computeRevenueWithRandomSelection();
-            r3 = max(r3, r);
+        vector<int> r(rounds);
+        if (pool != NULL) {
+            if (scratch.size() < pool->size) scratch.resize(pool->size);
+            pool->parallelFor(rounds, [&](int i, int worker) {
+                r[i] = _computeRevenueWithRandomSelection(i, worker);
+            });
+        } else {
+            for (int i = 0; i < rounds; i++) {
+                r[i] = _computeRevenueWithRandomSelection(i);
+            }
+        }
+        for (int i = 0; i < rounds; i++) {
+            r3 = max(r3, r[i]);
         }
         if (r1 == max(max(r1,r2), r3)) {
 //            cout << 1 << endl;
@@ -139,36 +230,37 @@ struct ApproximateAlgorithm {
     }
     
     int _computeRevenueWithLeastPrice() {
-        _init();
+        PassScratch& S = _init();
+        PRICING_STAT(AA_PASSES);
+        vector<int>& label_user_list = S.label_user_list;
+        vector<int>& used_users = S.used_users;
+        vector<int>& satisfiable_count = S.satisfiable_count;
+        int pass = S.pass;
+        
+        _sortLabelsByPrice();
         
         int revenue = 0;
         
         vector<pair<int, int> > selected_users;
 
         for (int k = 0; k < M; ++k) {
+            _expireLabels(k, S);
             int l = get<0>(requests[k]);
             int d = get<1>(requests[k]);
             int v = get<2>(requests[k]);
             if (v < pricing[l]) continue;
+            PRICING_STAT_ADD(AA_USERS_SCANNED, S.label_end[l] - users->labelFirst()[l]);
             selected_users.clear();
-            for (int i = 0; i < label_user_list[l].size(); ++i) {
-                int u = label_user_list[l][i];
-                if (used_users[u]) continue;
-                int max_other_price = 0;
-                int satisfiable_label_count = 0;
-                for (const auto& label : users[u]) {
-                    if (satisfiable_labels[k][label]) {
-                        satisfiable_label_count++;
-                        assert(label < L);
-                        if (label != l && pricing[label] > max_other_price)
-                            max_other_price = pricing[label];
-                    }
-                }
+            for (unsigned long long i = users->labelFirst()[l]; i < S.label_end[l]; ++i) {
+                int u = label_user_list[i];
+                if (used_users[u] == pass) continue;
+                int max_other_price = _maxOtherPrice(u, l, k);
+                int satisfiable_label_count = satisfiable_count[u];
                 if (satisfiable_label_count == 1 && d > 0) {
                     // if the user can be used for this request only, then we just use the user.
                     revenue += pricing[l];
                     d--;
-                    used_users[u] = 1;
+                    used_users[u] = pass;
                 } else {
                     selected_users.push_back(make_pair(u, max_other_price));
                 }
@@ -177,50 +269,48 @@ struct ApproximateAlgorithm {
             int i = 0;
             while (d > 0 && i < selected_users.size()) {
                 revenue += pricing[l];
-                assert(!used_users[selected_users[i].first]);
-                used_users[selected_users[i].first] = 1;
+                assert(used_users[selected_users[i].first] != pass);
+                used_users[selected_users[i].first] = pass;
                 d--;
                 i++;
             }
-            label_user_list[l].clear();
+            S.label_end[l] = users->labelFirst()[l];
             for (;i < selected_users.size(); ++i) {
-                label_user_list[l].push_back(selected_users[i].first);
+                label_user_list[S.label_end[l]++] = selected_users[i].first;
             }
         }
         return revenue;
     }
     
     int _computeRevenueWithLeastLabels() {
-        _init();
+        PassScratch& S = _init();
+        PRICING_STAT(AA_PASSES);
+        vector<int>& label_user_list = S.label_user_list;
+        vector<int>& used_users = S.used_users;
+        vector<int>& satisfiable_count = S.satisfiable_count;
+        int pass = S.pass;
         
         int revenue = 0;
         
         vector<pair<int, int> > selected_users;
         
         for (int k = 0; k < M; ++k) {
+            _expireLabels(k, S);
             int l = get<0>(requests[k]);
             int d = get<1>(requests[k]);
             int v = get<2>(requests[k]);
             if (v < pricing[l]) continue;
+            PRICING_STAT_ADD(AA_USERS_SCANNED, S.label_end[l] - users->labelFirst()[l]);
             selected_users.clear();
-            for (int i = 0; i < label_user_list[l].size(); ++i) {
-                int u = label_user_list[l][i];
-                if (used_users[u]) continue;
-                int max_other_price = 0;
-                int satisfiable_label_count = 0;
-                for (const auto& label : users[u]) {
-                    if (satisfiable_labels[k][label]) {
-                        satisfiable_label_count++;
-                        assert(label < L);
-                        if (label != l && pricing[label] > max_other_price)
-                            max_other_price = pricing[label];
-                    }
-                }
+            for (unsigned long long i = users->labelFirst()[l]; i < S.label_end[l]; ++i) {
+                int u = label_user_list[i];
+                if (used_users[u] == pass) continue;
+                int satisfiable_label_count = satisfiable_count[u];
                 if (satisfiable_label_count == 1 && d > 0) {
                     // if the user can be used for this request only, then we just use the user.
                     revenue += pricing[l];
                     d--;
-                    used_users[u] = 1;
+                    used_users[u] = pass;
                 } else {
                     selected_users.push_back(make_pair(u, satisfiable_label_count));
                 }
@@ -229,61 +319,63 @@ struct ApproximateAlgorithm {
             int i = 0;
             while (d > 0 && i < selected_users.size()) {
                 revenue += pricing[l];
-                assert(!used_users[selected_users[i].first]);
-                used_users[selected_users[i].first] = 1;
+                assert(used_users[selected_users[i].first] != pass);
+                used_users[selected_users[i].first] = pass;
                 d--;
                 i++;
             }
-            label_user_list[l].clear();
+            S.label_end[l] = users->labelFirst()[l];
             for (;i < selected_users.size(); ++i) {
-                label_user_list[l].push_back(selected_users[i].first);
+                label_user_list[S.label_end[l]++] = selected_users[i].first;
             }
         }
         return revenue;
     }
     
-    int _computeRevenueWithRandomSelection() {
-        _init();
+    int _computeRevenueWithRandomSelection(int round = 0, int worker = 0) {
+        PassScratch& S = _init(worker);
+        PRICING_STAT(AA_PASSES);
+        vector<int>& label_user_list = S.label_user_list;
+        vector<int>& used_users = S.used_users;
+        vector<int>& satisfiable_count = S.satisfiable_count;
+        int pass = S.pass;
+        mt19937_64 rng(seed + round);
         
         int revenue = 0;
         vector<int> selected_users;
-        srand(time(NULL));
         
         for (int k = 0; k < M; ++k) {
+            _expireLabels(k, S);
             int l = get<0>(requests[k]);
             int d = get<1>(requests[k]);
             int v = get<2>(requests[k]);
             if (v < pricing[l]) continue;
+            PRICING_STAT_ADD(AA_USERS_SCANNED, S.label_end[l] - users->labelFirst()[l]);
             selected_users.clear();
-            for (int i = 0; i < label_user_list[l].size(); ++i) {
-                int u = label_user_list[l][i];
-                if (used_users[u]) continue;
-                int satisfiable_label_count = 0;
-                for (const auto& label : users[u]) {
-                    if (satisfiable_labels[k][label]) {
-                        satisfiable_label_count++;
-                    }
-                }
+            for (unsigned long long i = users->labelFirst()[l]; i < S.label_end[l]; ++i) {
+                int u = label_user_list[i];
+                if (used_users[u] == pass) continue;
+                int satisfiable_label_count = satisfiable_count[u];
                 if (satisfiable_label_count == 1 && d > 0) {
                     // if the user can be used for this request only, then we just use the user.
                     revenue += pricing[l];
                     d--;
-                    used_users[u] = 1;
+                    used_users[u] = pass;
                 } else {
                     selected_users.push_back(u);
                 }
             }
-            random_shuffle(selected_users.begin(), selected_users.end());
+            shuffle(selected_users.begin(), selected_users.end(), rng);
             int i = 0;
             while (d > 0 && i < selected_users.size()) {
                 revenue += pricing[l];
-                used_users[selected_users[i]] = 1;
+                used_users[selected_users[i]] = pass;
                 d--;
                 i++;
             }
-            label_user_list[l].clear();
+            S.label_end[l] = users->labelFirst()[l];
             for (;i < selected_users.size(); ++i) {
-                label_user_list[l].push_back(selected_users[i]);
+                label_user_list[S.label_end[l]++] = selected_users[i];
             }
         }
         return revenue;
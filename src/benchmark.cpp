@@ -0,0 +1,220 @@
+#include "data_generator.h"
+#include "solver.h"
+
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Times the main stages of the solver on the configurations of
+// results/readme.txt with fixed seeds and prints one JSON object:
+//
+//     benchmark [repetitions] [configuration ...]
+//
+// with the configurations exp2, exp22, op, exp3_large or all; the default
+// is exp2 exp22 op, exp3_large needs several GB of memory.  op was run with
+// valuations up to 5, here MAX_VALUATION applies to every configuration.
+// The _pool batch stages run on one thread per core.  Every configuration
+// runs in a process of its own, so its peak_rss_kb is not that of an
+// earlier, larger one.  local_search_round is the round alone, without the
+// uniform sweep and the first min cost flow the search starts from.
+// Built with -DPRICING_STATS the counters of each configuration are
+// included, at the price of slower stages.
+
+struct BenchmarkConfig {
+    string name;
+    int N, M, L, L_user;
+    bool approximate_search; // local search with the approximate revenue
+};
+
+const BenchmarkConfig CONFIGS[] = {
+    {"exp2", 100, 1000, 50, 20, false},
+    {"exp22", 100, 1000, 50, 20, true},
+    {"op", 50, 200, 10, 4, false},
+    {"exp3_large", 1000, 500000, 500, 200, true},
+};
+
+const unsigned long long DATA_SEED = 1;
+const unsigned long long PRICING_SEED = 2;
+const unsigned long long ROUNDS_SEED = 3;
+const int BATCH = 32; // pricings of the batch stages
+
+long peakRSS() {
+    // in KB
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+struct Stage {
+    string name;
+    vector<double> seconds;
+    long long evaluations; // per repetition, 0 if not meaningful
+};
+
+double percentile(vector<double> v, double p) {
+    // nearest rank
+    sort(v.begin(), v.end());
+    int k = max(0, min(int(v.size()) - 1, int(p * v.size() + 0.999999) - 1));
+    return v[k];
+}
+
+Stage timeStage(string name, int repetitions, const function<long long()>& run) {
+    Stage stage{name, vector<double>(0), 0};
+    for (int r = 0; r < repetitions; ++r) {
+        auto t1 = chrono::steady_clock::now();
+        stage.evaluations = run();
+        auto t2 = chrono::steady_clock::now();
+        stage.seconds.push_back(chrono::duration<double>(t2 - t1).count());
+    }
+    return stage;
+}
+
+void printStage(const Stage& stage, bool last) {
+    double median = percentile(stage.seconds, 0.5);
+    cout << "        \"" << stage.name << "\": {\"median_s\": " << median;
+    cout << ", \"p95_s\": " << percentile(stage.seconds, 0.95);
+    if (stage.evaluations > 0) {
+        cout << ", \"evaluations\": " << stage.evaluations;
+        cout << ", \"evaluations_per_s\": " << (median > 0 ? stage.evaluations / median : 0);
+    }
+    cout << "}" << (last ? "" : ",") << endl;
+}
+
+void runConfig(const BenchmarkConfig& c, int repetitions, int threads, bool last) {
+    ThreadPool pool(threads);
+    NetworkData data;
+    vector<Stage> stages(0);
+    stages.push_back(timeStage("generate", repetitions, [&]() {
+        data.init(c.N, c.M, c.L, c.L_user, DATA_SEED);
+        return 0LL;
+    }));
+    
+    ProblemSolver ps(data);
+    ps.aa.setRandomRounds(10, ROUNDS_SEED);
+    SplitMix64 rng(PRICING_SEED, 0);
+    vector<vector<int> > pricings(BATCH, vector<int>(0));
+    for (auto& p : pricings) {
+        for (int l = 0; l < c.L; ++l) {
+            p.push_back(rng.uniform(MAX_VALUATION) + 1);
+        }
+    }
+    const vector<int>& pricing = pricings[0];
+    
+    stages.push_back(timeStage("arbitrage_free", repetitions, [&]() {
+        ps._computeArbitrageFreeConstraints();
+        return 0LL;
+    }));
+    stages.push_back(timeStage("uniform_sweep", repetitions, [&]() {
+        return (long long)ps.sweepUniformPrices().size();
+    }));
+    stages.push_back(timeStage("exact_evaluation", repetitions, [&]() {
+        ps._getRevenueByPriceTiers(pricing);
+        return 1LL;
+    }));
+    stages.push_back(timeStage("approximate_evaluation", repetitions, [&]() {
+        ps._getApproximateRevenueForNonuniformPricing(pricing, ps.aa);
+        return 1LL;
+    }));
+    for (int exact = 1; exact >= 0; --exact) {
+        for (ThreadPool* p : {(ThreadPool*)NULL, &pool}) {
+            string name = string(exact ? "exact_batch" : "approximate_batch") + (p != NULL ? "_pool" : "");
+            stages.push_back(timeStage(name, repetitions, [&]() {
+                ps.exact_cache.clear();
+                ps.approximate_cache.clear();
+                ps.evaluateBatch(pricings, exact, p);
+                return (long long)pricings.size();
+            }));
+        }
+    }
+    // timed by the search, whose clock starts after its setup
+    Stage round{"local_search_round", vector<double>(0), 0};
+    SearchProgress done{};
+    ps.setSearchBudget(0, 0, [&](const SearchProgress& p) { done = p; }, 1);
+    for (int r = 0; r < repetitions; ++r) {
+        ps.exact_cache.clear();
+        ps.approximate_cache.clear();
+        ps.findLocallyOptimalNonuiformPricing(c.approximate_search, 0);
+        round.seconds.push_back(done.elapsed);
+        round.evaluations = done.evaluations;
+    }
+    stages.push_back(round);
+    
+    cout << "    \"" << c.name << "\": {" << endl;
+    cout << "      \"N\": " << c.N << ", \"M\": " << c.M << ", \"L\": " << c.L << ", \"L_user\": " << c.L_user << "," << endl;
+    cout << "      \"local_search\": \"" << (c.approximate_search ? "approximate" : "exact") << "\"," << endl;
+    cout << "      \"peak_rss_kb\": " << peakRSS() << "," << endl;
+    cout << "      \"stages\": {" << endl;
+    for (int i = 0; i < stages.size(); ++i) {
+        printStage(stages[i], i + 1 == stages.size());
+    }
+    cout << "      }," << endl;
+    cout << "      \"stats\": ";
+    printStats(cout);
+    cout << "    }" << (last ? "" : ",") << endl;
+}
+
+int main(int argc, char* argv[]) {
+    int repetitions = argc > 1 ? atoi(argv[1]) : 5;
+    assert(repetitions > 0);
+    vector<string> names(0);
+    for (int i = 2; i < argc; ++i) {
+        if (string(argv[i]) == "all") {
+            for (const auto& c : CONFIGS) names.push_back(c.name);
+        } else {
+            names.push_back(argv[i]);
+        }
+    }
+    if (names.empty()) names = {"exp2", "exp22", "op"};
+    
+    vector<BenchmarkConfig> configs(0);
+    for (const auto& name : names) {
+        bool found = false;
+        for (const auto& c : CONFIGS) {
+            if (c.name == name) {
+                configs.push_back(c);
+                found = true;
+            }
+        }
+        if (!found) {
+            cerr << "unknown configuration " << name << endl;
+            return 1;
+        }
+    }
+    
+    int threads = max(1u, thread::hardware_concurrency());
+    cout.precision(6);
+    cout << "{" << endl;
+    cout << "  \"repetitions\": " << repetitions << "," << endl;
+    cout << "  \"threads\": " << threads << "," << endl;
+    cout << "  \"max_valuation\": " << MAX_VALUATION << "," << endl;
+    cout << "  \"configurations\": {" << endl;
+    for (int i = 0; i < configs.size(); ++i) {
+        cout.flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            runConfig(configs[i], repetitions, threads, i + 1 == configs.size());
+            cout.flush();
+            _exit(0);
+        }
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            cerr << "configuration " << configs[i].name << " failed" << endl;
+            return 1;
+        }
+    }
+    cout << "  }" << endl;
+    cout << "}" << endl;
+}
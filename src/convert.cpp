@@ -0,0 +1,34 @@
+#include "data_generator.h"
+
+#include <iostream>
+#include <string>
+#include <assert.h>
+
+using namespace std;
+
+// converts text data files (as in data/) to the binary format of
+// NetworkData::loadFromBinaryFile() and checks that they read back the same
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        cout << "usage: " << argv[0] << " <text file> <binary file>" << endl;
+        return 1;
+    }
+    NetworkData data;
+    data.loadFromFile(argv[1]);
+    data.saveToBinaryFile(argv[2]);
+    
+    NetworkData binary;
+    try {
+        binary.loadFromBinaryFile(argv[2]);
+    } catch (const runtime_error& e) {
+        cout << e.what() << endl;
+        return 1;
+    }
+    assert(binary.M == data.M && binary.N == data.N && binary.L == data.L);
+    assert(binary.requests == data.requests);
+    for (int i = 0; i < data.M; ++i) {
+        assert(binary.user_index->size(i) == data.user_index->size(i));
+        assert(equal(data.user_index->begin(i), data.user_index->end(i), binary.user_index->begin(i)));
+    }
+    cout << "Buyers: " << data.N << " Users: " << data.M << " L: " << data.L << " -> " << argv[2] << endl;
+}
@@ -19,6 +19,16 @@
 #include <random>
 #include <utility>
 #include <fstream>
+#include <tuple>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+#include <limits>
+
+#include "user_label_index.h"
+#include "thread_pool.h"
 
 using namespace std;
 
@@ -26,44 +36,111 @@ using namespace std;
 typedef tuple<unsigned short, unsigned short, unsigned short> Request;
 typedef vector<unsigned short> User;
 
-const int MAX_USER = 1000000;
 const int MAX_BUYER = 1000;
 const int MAX_LABEL = 500;
 const int MAX_VALUATION = 1000;
 
-//const int MAX_USER = 200;
 //const int MAX_BUYER = 50;
 //const int MAX_LABEL = 10;
 //const int MAX_VALUATION = 5;
 
+// binary file: this header, the requests as (label, demand, valuation) uint16
+// triples, the user offsets as uint64 from the next multiple of 8 and then
+// the uint16 labels of all users; native byte order
+const char BINARY_MAGIC[8] = "PRICING";
+const unsigned int BINARY_VERSION = 1;
+
+struct BinaryHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int M, N, L;
+    unsigned int reserved;
+    unsigned long long n_labels; // total number of labels of all users
+};
+
+// splitmix64 with one stream per index: user i draws from stream i+1 and
+// the requests from stream 0, so an instance only depends on the seed and
+// not on which thread generates which user.  The start of a stream is the
+// mixed (seed, stream) pair; adding the stream to the state instead would
+// make stream i+1 stream i shifted by one draw.
+struct SplitMix64 {
+    unsigned long long state;
+    
+    SplitMix64(unsigned long long seed, unsigned long long stream) :
+    state(mix(seed ^ mix(stream + 1))) {}
+    
+    static unsigned long long mix(unsigned long long z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    
+    unsigned long long next() {
+        return mix(state += 0x9e3779b97f4a7c15ULL);
+    }
+    
+    int uniform(int n) { // in [0, n)
+        return next() % n;
+    }
+};
+
+const int USER_SHARD = 4096; // users generated per task
+
 struct NetworkData {
     int N; // number of buyers
     int M; // number of users
     int L; // number of labels
     int D; // number of max demand
     int L_user; // number of labels one user can have at most
+    unsigned long long seed; // of the generated instance, 0 if loaded from a file
     string prefix;
     vector<Request> requests;
-    vector<User> users;
+    shared_ptr<const UserLabelIndex> user_index; // labels of every user, set by init() and the loaders
     
-    NetworkData () {
+    NetworkData () : seed(0) {
     }
     
     void init(int N, int M, int L, int L_user) {
-        srand(unsigned(time(0)));
-        this->N = N;
-        this->M = M;
-        this->L = L;
-        this->L_user = L_user;
-        D = M * 4 / N;
-        assert(N>=L);
+        init(N, M, L, L_user, time(0));
+    }
+    
+    void init(int N, int M, int L, int L_user, unsigned long long seed, ThreadPool* pool=NULL) {
+        // the same seed gives the same instance for any pool
+        _setParameters(N, M, L, L_user, seed);
         _generateRequests();
-        _generateUsers();
+        vector<unsigned long long> first = _generateUserOffsets(pool);
+        vector<unsigned short> user_labels(first[M]);
+        _generateUsers(0, (M + USER_SHARD - 1) / USER_SHARD, first, &user_labels[0], 0, pool);
+        user_index = make_shared<UserLabelIndex>(L, first, user_labels);
+    }
+    
+    void generateToBinaryFile(string file_name, int N, int M, int L, int L_user, unsigned long long seed, ThreadPool* pool=NULL) {
+        // the instance of init() written straight to a binary file, holding
+        // the labels of a bounded number of shards at a time; user_index is
+        // not set, load the file to use the instance
+        _setParameters(N, M, L, L_user, seed);
+        _generateRequests();
+        vector<unsigned long long> first = _generateUserOffsets(pool);
+        ofstream fout(file_name, ios::binary);
+        _writeBinaryPrefix(fout, first);
+        int shards = (M + USER_SHARD - 1) / USER_SHARD;
+        int batch = 64;
+        vector<unsigned short> buffer(0);
+        for (int s = 0; s < shards; s += batch) {
+            int end = min(shards, s + batch);
+            unsigned long long from = first[s * USER_SHARD], to = first[min(M, end * USER_SHARD)];
+            buffer.resize(to - from);
+            _generateUsers(s, end, first, buffer.data(), from, pool);
+            fout.write((const char*)buffer.data(), sizeof(unsigned short) * buffer.size());
+        }
+        fout.close();
+        user_index.reset();
     }
     
     void loadFromFile(string file_name) {
         ifstream fin(file_name);
         fin >> M >> N >> L;
+        seed = 0;
         
         requests.clear();
         for (int i = 0; i < N; ++i) {
@@ -72,72 +149,188 @@ struct NetworkData {
             requests.push_back(Request(l, d, v));
         }
         
-        users.clear();
+        vector<unsigned long long> first(1, 0);
+        vector<unsigned short> user_labels;
         for (int i = 0; i < M;++i) {
             int n;
-            User u;
-            u.clear();
             fin >> n;
             for (int j = 0; j < n; ++j) {
                 int l;
                 fin >> l;
-                u.push_back(l);
+                user_labels.push_back(l);
             }
-            users.push_back(u);
+            first.push_back(user_labels.size());
         }
         fin.close();
+        user_index = make_shared<UserLabelIndex>(L, first, user_labels);
+    }
+    
+    void loadFromBinaryFile(string file_name) {
+        // the users stay in the mapped file, only the requests are copied;
+        // throws runtime_error if the file is not a complete, consistent
+        // network of this version, and then leaves the data unchanged
+        shared_ptr<MappedFile> file = make_shared<MappedFile>(file_name);
+        auto fail = [&](const string& reason) {
+            throw runtime_error(file_name + ": " + reason);
+        };
+        if (file->size < sizeof(BinaryHeader)) fail("too short for a header");
+        const BinaryHeader& header = *(const BinaryHeader*)file->data;
+        if (memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0) fail("not a network file");
+        if (header.version != BINARY_VERSION) fail("unsupported version " + to_string(header.version));
+        if (header.L == 0 || header.L > 65536) fail("bad number of labels"); // labels are unsigned short
+        if (header.M >= numeric_limits<int>::max() || header.N >= numeric_limits<int>::max()) fail("too many users or requests");
+        
+        // sizes in 64 bits, M, N and n_labels come from the file
+        unsigned long long offset = sizeof(BinaryHeader);
+        const unsigned short* r = (const unsigned short*)(file->data + offset);
+        offset = (offset + 3ULL * sizeof(unsigned short) * header.N + 7) / 8 * 8;
+        const unsigned long long* first = (const unsigned long long*)(file->data + offset);
+        offset += sizeof(unsigned long long) * (header.M + 1ULL);
+        if (offset > file->size) fail("truncated");
+        if (header.n_labels > (file->size - offset) / sizeof(unsigned short)) fail("truncated");
+        const unsigned short* labels = (const unsigned short*)(file->data + offset);
+        
+        // the index reads labels[first[u]] .. labels[first[u+1]-1] unchecked
+        if (first[0] != 0 || first[header.M] != header.n_labels) fail("user offsets do not match the labels");
+        for (unsigned int u = 0; u < header.M; ++u) {
+            if (first[u] > first[u + 1]) fail("user offsets decrease");
+        }
+        for (unsigned long long i = 0; i < header.n_labels; ++i) {
+            if (labels[i] >= header.L) fail("label out of range");
+        }
+        vector<Request> loaded(0);
+        for (unsigned int i = 0; i < header.N; ++i) {
+            if (r[3*i] >= header.L) fail("request label out of range");
+            loaded.push_back(Request(r[3*i], r[3*i+1], r[3*i+2]));
+        }
+        
+        M = header.M;
+        N = header.N;
+        L = header.L;
+        seed = 0;
+        requests.swap(loaded);
+        user_index = make_shared<UserLabelIndex>(file, M, L, first, labels);
+    }
+    
+    void saveToBinaryFile(string file_name) {
+        ofstream fout(file_name, ios::binary);
+        _writeBinaryPrefix(fout, vector<unsigned long long>(user_index->first, user_index->first + M + 1));
+        fout.write((const char*)user_index->labels, sizeof(unsigned short) * user_index->first[M]);
+        fout.close();
+    }
+    
+    void _writeBinaryPrefix(ofstream& fout, const vector<unsigned long long>& first) {
+        // everything up to the labels of the users
+        BinaryHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+        header.version = BINARY_VERSION;
+        header.M = M;
+        header.N = N;
+        header.L = L;
+        header.n_labels = first[M];
+        
+        fout.write((const char*)&header, sizeof(header));
+        for (const auto& request : requests) {
+            unsigned short r[3] = {get<0>(request), get<1>(request), get<2>(request)};
+            fout.write((const char*)r, sizeof(r));
+        }
+        size_t offset = sizeof(header) + 3 * sizeof(unsigned short) * N;
+        for (; offset % 8 != 0; ++offset) {
+            fout.put(0);
+        }
+        fout.write((const char*)first.data(), sizeof(unsigned long long) * (M + 1));
     }
     
     void saveToFile() {
         string file_name = "data/" + prefix + "_" + "0_revenue";
         ofstream fout(file_name);
-        fout << M << " " << N << " " << L;
+        fout << M << " " << N << " " << L << endl;
         for (const auto& request : requests) {
             int l = get<0>(request);
             int d = get<1>(request);
             int v = get<2>(request);
             fout << l << " " << d << " " << v << endl;
         }
-        for (const auto& user : users) {
-            fout << user.size();
-            for (const auto& l : user) {
-                fout << " " << l;
+        for (int i = 0; i < M; ++i) {
+            fout << user_index->size(i);
+            for (const unsigned short* l = user_index->begin(i); l != user_index->end(i); ++l) {
+                fout << " " << *l;
             }
             fout << endl;
         }
         fout.close();
     }
     
+    void _setParameters(int N, int M, int L, int L_user, unsigned long long seed) {
+        this->N = N;
+        this->M = M;
+        this->L = L;
+        this->L_user = L_user;
+        this->seed = seed;
+        D = M * 4 / N;
+        assert(N>=L);
+        assert(L_user <= L);
+    }
+    
     void _generateRequests() {
+        SplitMix64 rng(seed, 0);
         requests.clear();
         for (int i = 0; i < N; ++i) {
-            int l = i < L? i : rand() % L; // make sure every label has one buyer
-            int d = rand() % D + 1;
-            //cout << d << endl;
-            int v = rand() % MAX_VALUATION + 1;       // we assume v is [1, 100]
+            int l = i < L? i : rng.uniform(L); // make sure every label has one buyer
+            int d = rng.uniform(D) + 1;
+            int v = rng.uniform(MAX_VALUATION) + 1;       // we assume v is [1, 100]
             requests.push_back(Request(l, d, v));
         }
     }
     
-    void _generateUsers() {
-        users.clear();
-        vector<unsigned short> labels;
-        
-        // start from 1
-        for (int l = 1; l < L; ++l) {
-            labels.push_back(l);
+    vector<unsigned long long> _generateUserOffsets(ThreadPool* pool) {
+        // the first draw of a user is its number of labels
+        vector<unsigned long long> first(M + 1, 0);
+        _forEachShard(0, (M + USER_SHARD - 1) / USER_SHARD, pool, [&](int u, int worker) {
+            SplitMix64 rng(seed, u + 1);
+            first[u + 1] = rng.uniform(L_user) + 1;
+        });
+        for (int u = 0; u < M; ++u) {
+            first[u + 1] += first[u];
         }
-        for (int i = 0; i < M; ++i) {
-            vector<unsigned short> user(0);
-            assert(user.size() == 0);
-            user.push_back(0); // make sure every user has label 0
-            int n_l = rand() % L_user + 1;
-            random_shuffle(labels.begin(), labels.end());
-            // label 0 is already inserted
-            for (int i = 0; i < n_l - 1; ++i) {
-                user.push_back(labels[i]);
+        return first;
+    }
+    
+    void _generateUsers(int from, int to, const vector<unsigned long long>& first, unsigned short* user_labels, unsigned long long base, ThreadPool* pool) {
+        // labels of the users of shards from .. to-1 into user_labels[first[u] - base] ..;
+        // label 0 and then n_l - 1 distinct labels of 1 .. L-1 by Floyd's
+        // algorithm, which draws n_l - 1 numbers instead of shuffling all labels
+        vector<vector<int> > chosen(pool != NULL ? pool->size : 1); // chosen[worker][t] == u iff label t+1 is drawn for u
+        _forEachShard(from, to, pool, [&](int u, int worker) {
+            vector<int>& mark = chosen[worker];
+            if (mark.empty()) mark.assign(L, -1);
+            SplitMix64 rng(seed, u + 1);
+            int n_l = rng.uniform(L_user) + 1;
+            unsigned long long pos = first[u] - base;
+            user_labels[pos++] = 0; // make sure every user has label 0
+            for (int j = L - n_l; j < L - 1; ++j) {
+                int t = rng.uniform(j + 1);
+                if (mark[t] == u) t = j;
+                mark[t] = u;
+                user_labels[pos++] = t + 1;
+            }
+        });
+    }
+    
+    void _forEachShard(int from, int to, ThreadPool* pool, const function<void(int, int)>& fn) {
+        // fn(u, worker) for the users of shards from .. to-1
+        auto shard = [&](int s, int worker) {
+            for (int u = s * USER_SHARD; u < min(M, (s + 1) * USER_SHARD); ++u) {
+                fn(u, worker);
+            }
+        };
+        if (pool != NULL) {
+            pool->parallelFor(to - from, [&](int i, int worker) { shard(from + i, worker); });
+        } else {
+            for (int s = from; s < to; ++s) {
+                shard(s, 0);
             }
-            users.push_back(user);
         }
     }
 };
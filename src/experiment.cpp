@@ -1,6 +1,8 @@
 #include "data_generator.h"
 #include "max_flow.h"
 #include "min_cost_flow.h"
+#include "parallel_max_flow.h"
+#include "thread_pool.h"
 #include "approximate_min_cost_flow.h"
 #include "solver.h"
 
@@ -12,12 +14,14 @@
 #include <map>
 #include <time.h>
 #include <cstring>
+#include <chrono>
+#include <functional>
 
 using namespace std;
 
-void runEvaluation(int N, int M, int L, int L_user) {
+void runEvaluation(int N, int M, int L, int L_user, int cases) {
     int n_cases = 1;
-    while (true) {
+    while (n_cases <= cases) {
         cout << "case: " << n_cases++ << endl;
         NetworkData data;
         data.init(N,M,L,L_user);
@@ -74,15 +78,93 @@ void runExperiment22(int N, int M, int L, int L_user) {
     }
 }
 
+void runParallelScaling(int N, int M, int L, int L_user, int max_threads) {
+    // max flow at half the maximum valuation for 1..max_threads threads, on
+    // the graph of ProblemSolver.  The graph is built here instead of by a
+    // solver, which would also hold its min cost flow and price tier copies,
+    // and only one graph exists at a time, so 1000 500000 500 200 fits in
+    // a few GB.
+    NetworkData data;
+    data.init(N,M,L,L_user);
+    map<User, int> classes;
+    User labels;
+    for (int i = 0; i < M; ++i) {
+        labels.assign(data.user_index->begin(i), data.user_index->end(i));
+        sort(labels.begin(), labels.end());
+        classes[labels] += 1;
+    }
+    int K = classes.size();
+    int n = K + N + L + 2, source = N + K + L, sink = source + 1;
+    auto addEdges = [&](const function<void(int, int, int)>& add) {
+        // as ProblemSolver::_genearteEdge() and the source and sink arcs
+        int k = 0;
+        for (const auto& c : classes) {
+            add(source, k, c.second);
+            for (const auto& l : c.first) {
+                add(k, K+l, c.second);
+            }
+            k++;
+        }
+        for (int i = 0; i < N; ++i) {
+            int l = get<0>(data.requests[i]);
+            add(K+l, K+L+i, data.user_index->labelSize(l));
+            add(K+L+i, sink, get<2>(data.requests[i]) >= MAX_VALUATION/2 ? get<1>(data.requests[i]) : 0);
+        }
+    };
+    cout << "classes: " << K << endl;
+    
+    int flow;
+    {
+        PushRelabel g(n);
+        addEdges([&](int from, int to, int cap) { g.AddEdge(from, to, cap); });
+        auto t1 = chrono::steady_clock::now();
+        flow = g.GetMaxFlow(source, sink);
+        auto t2 = chrono::steady_clock::now();
+        cout << "sequential: " << flow << " " << chrono::duration<double>(t2 - t1).count() << "s" << endl;
+    }
+    
+    for (int threads = 1; threads <= max_threads; ++threads) {
+        ThreadPool pool(threads);
+        ParallelPushRelabel pg(n, &pool);
+        addEdges([&](int from, int to, int cap) { pg.AddEdge(from, to, cap); });
+        auto t1 = chrono::steady_clock::now();
+        int parallel_flow = pg.GetMaxFlow(source, sink);
+        auto t2 = chrono::steady_clock::now();
+        assert(parallel_flow == flow);
+        cout << threads << " threads: " << chrono::duration<double>(t2 - t1).count() << "s" << endl;
+    }
+}
+
 int main(int argc, char* argv[]) {
+    // experiment N M L L_user [evaluation [cases] | experiment2 | experiment22 | scaling [threads]]
     srand(unsigned(time(0)));
-    assert(argc == 5);
+    if (argc < 5) {
+        cout << "usage: " << argv[0] << " N M L L_user [evaluation [cases] | experiment2 | experiment22 | scaling [threads]]" << endl;
+        return 1;
+    }
     int N = atoi(argv[1]);
     int M = atoi(argv[2]);
     int L = atoi(argv[3]);
     int L_user = atoi(argv[4]);
+    string mode = argc > 5 ? argv[5] : "evaluation";
     cout << "Buyers: " << N << " Users: " << M << " L: " << L << " L per user: " << L_user << " Max Valution:" << MAX_VALUATION << endl;
 
-    runEvaluation(N,M,L,L_user);
-//    runExperiment22(N,M,L,L_user);
+    if (mode == "evaluation") {
+        int cases = argc > 6 ? atoi(argv[6]) : 100;
+        runEvaluation(N,M,L,L_user,cases);
+    } else if (mode == "experiment2") {
+        runExperiment2(N,M,L,L_user);
+    } else if (mode == "experiment22") {
+        runExperiment22(N,M,L,L_user);
+    } else if (mode == "scaling") {
+        // e.g. 1000 500000 500 200 scaling, results/parallel_scaling.txt
+        int threads = argc > 6 ? atoi(argv[6]) : max(1, int(thread::hardware_concurrency()));
+        runParallelScaling(N,M,L,L_user,threads);
+    } else {
+        cout << "unknown mode " << mode << endl;
+        return 1;
+    }
+#ifdef PRICING_STATS
+    printStats(cout);
+#endif
 }
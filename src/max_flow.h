@@ -17,6 +17,23 @@
 //     - maximum flow value
 //     - To obtain the actual flow values, look at all edges with
 //       capacity > 0 (zero capacity edges are residual edges).
+//
+// The graph can be solved repeatedly: capacities may be rewritten
+// through the positions returned by AddEdge(), and every GetMaxFlow()
+// starts from zero flow.  After raising the capacities of arcs leaving
+// the source, Augment() continues from the current preflow instead:
+// the labels stay valid because only source arcs changed, so a sequence
+// of such steps costs about as much as a single max flow (Gallo,
+// Grigoriadis and Tarjan 1989).  If other capacities were raised, call
+// GlobalRelabel() first to make the labels valid again.
+//
+// PushRelabel(N, true) selects the highest label variant instead: active
+// nodes are kept in buckets by label and the highest one is discharged
+// first, each node keeps a current arc, the nodes below N are kept in one
+// list per label so that a gap only visits the nodes above it, and the
+// labels are recomputed by GlobalRelabel() once the relabel work exceeds
+// the size of the graph.
+// Running time O(|V|^2 sqrt(|E|)).
 
 #ifndef __MAX_FLOW__
 #define __MAX_FLOW__
@@ -26,6 +43,8 @@
 #include <iostream>
 #include <queue>
 
+#include "stats.h"
+
 using namespace std;
 
 typedef int LL;
@@ -43,21 +62,88 @@ struct PushRelabel {
     vector<int> dist, active, count;
     queue<int> Q;
     
-    PushRelabel(int N) : N(N), G(N), excess(N), dist(N), active(N), count(2*N) {}
+    // highest label selection
+    bool highest_label;
+    vector<vector<int> > bucket;     // active nodes by label, may be stale
+    vector<int> current;             // arcs before it are not admissible
+    vector<int> lhead, lnext, lprev; // nodes with label < N, by label
+    int max_active, max_label;
+    int arcs, work;                  // relabel work since the last global relabel
     
-    void AddEdge(int from, int to, int cap) {
+    PushRelabel(int N = 0, bool highest_label = false) :
+    N(N), G(N), excess(N), dist(N), active(N), count(2*N), highest_label(highest_label),
+    bucket(highest_label ? N : 0), current(highest_label ? N : 0),
+    lhead(highest_label ? N : 0, -1), lnext(highest_label ? N : 0), lprev(highest_label ? N : 0),
+    max_active(-1), max_label(0), arcs(0), work(0) {}
+    
+    int AddEdge(int from, int to, int cap) {
+        int pos = G[from].size();
+        arcs += 2;
         G[from].push_back(Edge(from, to, cap, 0, G[to].size()));
         if (from == to) G[from].back().index++;
         G[to].push_back(Edge(to, from, 0, 0, G[from].size() - 1));
+        return pos;
+    }
+    
+    void Reset() {
+        for (int v = 0; v < N; v++)
+            for (int i = 0; i < G[v].size(); i++) G[v][i].flow = 0;
+        fill(excess.begin(), excess.end(), 0);
+        fill(dist.begin(), dist.end(), 0);
+        fill(active.begin(), active.end(), 0);
+        fill(count.begin(), count.end(), 0);
+        ClearQueues();
+    }
+    
+    void ClearQueues() {
+        Q = queue<int>();
+        for (int d = 0; d < bucket.size(); d++) bucket[d].clear();
+        fill(lhead.begin(), lhead.end(), -1);
+        fill(current.begin(), current.end(), 0);
+        max_active = -1;
+        max_label = 0;
+        work = 0;
     }
     
     void Enqueue(int v) {
-        if (!active[v] && excess[v] > 0) { active[v] = true; Q.push(v); }
+        if (active[v] || excess[v] <= 0) return;
+        active[v] = true;
+        if (highest_label && dist[v] < N) {
+            bucket[dist[v]].push_back(v);
+            max_active = max(max_active, dist[v]);
+        } else {
+            Q.push(v);
+        }
+    }
+    
+    void Link(int v) {
+        int d = dist[v];
+        lprev[v] = -1;
+        lnext[v] = lhead[d];
+        if (lhead[d] != -1) lprev[lhead[d]] = v;
+        lhead[d] = v;
+        max_label = max(max_label, d);
+    }
+    
+    void Unlink(int v) {
+        if (lprev[v] != -1) lnext[lprev[v]] = lnext[v];
+        else lhead[dist[v]] = lnext[v];
+        if (lnext[v] != -1) lprev[lnext[v]] = lprev[v];
+    }
+    
+    void SetLabel(int v, int d) {
+        count[dist[v]]--;
+        if (highest_label && dist[v] < N) Unlink(v);
+        dist[v] = d;
+        count[dist[v]]++;
+        if (highest_label && dist[v] < N) Link(v);
+        if (highest_label) current[v] = 0;
     }
     
     void Push(Edge &e) {
         int amt = int(min(excess[e.from], LL(e.cap - e.flow)));
         if (dist[e.from] <= dist[e.to] || amt == 0) return;
+        PRICING_STAT(PR_PUSHES);
         e.flow += amt;
         G[e.to][e.index].flow -= amt;
         excess[e.to] += amt;
@@ -66,6 +152,19 @@ struct PushRelabel {
     }
     
     void Gap(int k) {
+        PRICING_STAT(PR_GAPS);
+        if (highest_label) {
+            // only the lists from k up to the highest label are visited;
+            // active nodes keep their old bucket and are moved when popped
+            for (int d = k; d <= max_label; d++)
+                while (lhead[d] != -1) {
+                    int v = lhead[d];
+                    SetLabel(v, N+1);
+                    Enqueue(v);
+                }
+            max_label = k-1;
+            return;
+        }
         for (int v = 0; v < N; v++) {
             if (dist[v] < k) continue;
             count[dist[v]]--;
@@ -76,19 +175,28 @@ struct PushRelabel {
     }
     
     void Relabel(int v) {
-        count[dist[v]]--;
-        dist[v] = 2*N;
+        PRICING_STAT(PR_RELABELS);
+        int d = 2*N;
         for (int i = 0; i < G[v].size(); i++)
             if (G[v][i].cap - G[v][i].flow > 0)
-                dist[v] = min(dist[v], dist[G[v][i].to] + 1);
-        count[dist[v]]++;
+                d = min(d, dist[G[v][i].to] + 1);
+        SetLabel(v, d);
+        work += G[v].size();
         Enqueue(v);
     }
     
     void Discharge(int v) {
-        for (int i = 0; excess[v] > 0 && i < G[v].size(); i++) Push(G[v][i]);
+        PRICING_STAT(PR_DISCHARGES);
+        if (highest_label) {
+            for (; excess[v] > 0 && current[v] < G[v].size(); current[v]++) {
+                Push(G[v][current[v]]);
+                if (excess[v] == 0) break;
+            }
+        } else {
+            for (int i = 0; excess[v] > 0 && i < G[v].size(); i++) Push(G[v][i]);
+        }
         if (excess[v] > 0) {
-            if (count[dist[v]] == 1)
+            if (dist[v] < N && count[dist[v]] == 1)
                 Gap(dist[v]);
             else
                 Relabel(v);
@@ -96,6 +204,7 @@ struct PushRelabel {
     }
     
     LL GetMaxFlow(int s, int t) {
+        Reset();
         count[0] = N-1;
         count[N] = 1;
         dist[s] = N;
@@ -104,14 +213,97 @@ struct PushRelabel {
             excess[s] += G[s][i].cap;
             Push(G[s][i]);
         }
+        if (highest_label) GlobalRelabel(s, t);
         
-        while (!Q.empty()) {
-            int v = Q.front();
-            Q.pop();
+        Run(s, t);
+        return FlowOut(s);
+    }
+    
+    LL Augment(int s, int t) {
+        for (int i = 0; i < G[s].size(); i++) {
+            Edge &e = G[s][i];
+            int amt = e.cap - e.flow;
+            if (amt <= 0) continue;
+            e.flow += amt;
+            G[e.to][e.index].flow -= amt;
+            excess[e.to] += amt;
+            if (highest_label) current[e.to] = 0; // its arc back to s opened
+            Enqueue(e.to);
+        }
+        
+        Run(s, t);
+        return FlowOut(s);
+    }
+    
+    void GlobalRelabel(int s, int t) {
+        // exact distances to t over the residual arcs by reverse BFS;
+        // nodes that cannot reach t any more are sent back to the source,
+        // labelled N plus their distance to it
+        fill(dist.begin(), dist.end(), 2*N);
+        dist[s] = N;
+        dist[t] = 0;
+        queue<int> B;
+        B.push(t);
+        for (int root = 0; root < 2; root++) {
+            while (!B.empty()) {
+                int v = B.front();
+                B.pop();
+                for (int i = 0; i < G[v].size(); i++) {
+                    Edge &e = G[G[v][i].to][G[v][i].index];
+                    if (e.cap - e.flow > 0 && dist[e.from] == 2*N) {
+                        dist[e.from] = dist[v] + 1;
+                        B.push(e.from);
+                    }
+                }
+            }
+            if (root == 0) B.push(s);
+        }
+        for (int v = 0; v < N; v++)
+            if (dist[v] == 2*N) dist[v] = N+1; // no excess can be left here
+        fill(count.begin(), count.end(), 0);
+        for (int v = 0; v < N; v++) count[dist[v]]++;
+        if (highest_label) {
+            ClearQueues();
+            for (int v = 0; v < N; v++) {
+                if (dist[v] < N) Link(v);
+                if (v != s && v != t) active[v] = false;
+            }
+        }
+        for (int v = 0; v < N; v++) Enqueue(v);
+    }
+    
+    void Run(int s, int t) {
+        // with highest_label the buckets hold the active nodes below N and
+        // Q the ones returning excess to the source, which wait until no
+        // node can reach t any more
+        while (true) {
+            int v;
+            if (highest_label && max_active >= 0) {
+                if (bucket[max_active].empty()) {
+                    max_active--;
+                    continue;
+                }
+                v = bucket[max_active].back();
+                bucket[max_active].pop_back();
+                if (dist[v] != max_active) {
+                    // raised by a gap while waiting, labels never decrease here
+                    active[v] = false;
+                    Enqueue(v);
+                    continue;
+                }
+            } else if (!Q.empty()) {
+                v = Q.front();
+                Q.pop();
+            } else {
+                break;
+            }
             active[v] = false;
             Discharge(v);
+            if (highest_label && work > N + arcs) GlobalRelabel(s, t);
         }
-        
+    }
+    
+    LL FlowOut(int s) {
         LL totflow = 0;
         for (int i = 0; i < G[s].size(); i++) totflow += G[s][i].flow;
         return totflow;
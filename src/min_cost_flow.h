@@ -1,11 +1,13 @@
-// Implementation of min cost max flow algorithm using adjacency
-// matrix (Edmonds and Karp 1972).  This implementation keeps track of
-// forward and reverse edges separately (so you can set cap[i][j] !=
-// cap[j][i]).  For a regular max flow, set all edge costs to 0.
+// Implementation of min cost max flow algorithm using successive
+// shortest paths (primal-dual) over a sparse residual graph.  Forward
+// and residual arcs are kept in the same flat arrays (arc e and arc e^1
+// are partners) and are indexed in compressed sparse row order.  Each
+// phase runs Dijkstra with a binary heap on the reduced costs and then
+// pushes blocking flows along the arcs of zero reduced cost.  Parallel
+// edges are kept as separate arcs.  Edge costs must be non-negative.
 //
-// Running time, O(|V|^2) cost per augmentation
-//     max flow:           O(|V|^3) augmentations
-//     min cost max flow:  O(|V|^4 * MAX_EDGE_COST) augmentations
+// Running time, O(|E| log |V|) per phase
+//     min cost max flow:  O(|F|) phases, usually far fewer
 //
 // INPUT:
 //     - graph, constructed using AddEdge()
@@ -14,92 +16,308 @@
 //
 // OUTPUT:
 //     - (maximum flow value, minimum cost value)
-//     - To obtain the actual flow, look at positive values only.
+//     - To obtain the actual flow, look at flow[e] for the edge ids
+//       returned by AddEdge().
+//
+// The graph can be solved repeatedly: SetEdge() rewrites the capacity
+// and cost of an arc, and every GetMaxFlow() starts from zero flow.
+//
+// After GetMaxFlow() the optimum can also be repaired in place: call
+// ChangeEdge() for every modified arc and then Reoptimize().  The flow
+// is closed into a circulation by a sink -> source arc of very negative
+// cost, arcs whose reduced cost turned negative are saturated (or
+// emptied), and the resulting excesses are routed along shortest paths
+// using the previous potentials, so the work depends on how much of the
+// graph the change reaches.  Simple path costs must stay below
+// CIRCULATION_COST.
 
 #ifndef __MIN_COST_FLOW__
 #define __MIN_COST_FLOW__
 
 #include <cmath>
 #include <vector>
+#include <queue>
+#include <limits>
+#include <algorithm>
 #include <iostream>
+#include <assert.h>
+
+#include "stats.h"
 
 using namespace std;
 
 typedef vector<int> VI;
-typedef vector<VI> VVI;
 typedef int FLOW_INT;
+typedef long long COST_INT; // potentials and path lengths
 typedef vector<FLOW_INT> VL;
-typedef vector<VL> VVL;
-typedef pair<int, int> PII;
-typedef vector<PII> VPII;
+typedef vector<COST_INT> VC;
+typedef pair<COST_INT, int> PCI;
 
 const FLOW_INT INF = numeric_limits<FLOW_INT>::max() / 4;
+const COST_INT COST_INF = numeric_limits<COST_INT>::max() / 4;
+const FLOW_INT CIRCULATION_COST = INF / 2;
 
 struct MinCostMaxFlow {
     int N;
-    VVL cap, flow, cost;
-    VI found;
-    VL dist, pi, width;
-    VPII dad;
-    
-    MinCostMaxFlow(int N) :
-    N(N), cap(N, VL(N)), flow(N, VL(N)), cost(N, VL(N)),
-    found(N), dist(N), pi(N), width(N), dad(N) {}
-    
-    void AddEdge(int from, int to, FLOW_INT cap, FLOW_INT cost) {
-        this->cap[from][to] = cap;
-        this->cost[from][to] = cost;
+    VI from, to;     // arc e goes from[e] -> to[e], arc e^1 is its residual
+    VL cap, flow, cost;
+    VI first, adj;   // arcs leaving v are adj[first[v]] .. adj[first[v+1]-1]
+    bool built;
+    VC dist, pi;
+    VI pred, current, level;
+    VI touched, settled; // nodes reached / finalized by the last Dijkstra
+    VI region;           // region[v] == epoch iff v was settled by it
+    VI layered;          // nodes with a level
+    int epoch;
+    FLOW_INT total_cost;
+
+    // warm start state
+    int circulation; // arc sink -> source, -1 before the first GetMaxFlow()
+    bool warm;
+    VL excess;
+    VI unbalanced;   // nodes whose excess may be non-zero
+
+    MinCostMaxFlow(int N = 0) :
+    N(N), built(false), dist(N, COST_INF), pi(N), pred(N), current(N), level(N, -1),
+    region(N, -1), epoch(0), total_cost(0), circulation(-1), warm(false), excess(N) {}
+
+    int AddEdge(int from, int to, FLOW_INT cap, FLOW_INT cost) {
+        int e = this->from.size();
+        this->from.push_back(from); this->to.push_back(to);
+        this->cap.push_back(cap); this->cost.push_back(cost);
+        this->from.push_back(to); this->to.push_back(from);
+        this->cap.push_back(0); this->cost.push_back(-cost);
+        flow.push_back(0); flow.push_back(0);
+        built = false;
+        return e;
     }
-    
-    void Relax(int s, int k, FLOW_INT cap, FLOW_INT cost, int dir) {
-        FLOW_INT val = dist[s] + pi[s] - pi[k] + cost;
-        if (cap && val < dist[k]) {
-            dist[k] = val;
-            dad[k] = make_pair(s, dir);
-            width[k] = cap < width[s] ? cap : width[s];
+
+    void SetEdge(int e, FLOW_INT cap, FLOW_INT cost) {
+        this->cap[e] = cap;
+        this->cost[e] = cost;
+        this->cost[e^1] = -cost;
+    }
+
+    void Reset() {
+        fill(flow.begin(), flow.end(), 0);
+        fill(pi.begin(), pi.end(), 0);
+        fill(excess.begin(), excess.end(), 0);
+        unbalanced.clear();
+        if (circulation != -1) SetEdge(circulation, 0, -CIRCULATION_COST);
+        warm = false;
+        total_cost = 0;
+    }
+
+    void Build() {
+        first.assign(N + 1, 0);
+        for (int e = 0; e < from.size(); e++) first[from[e] + 1]++;
+        for (int v = 0; v < N; v++) first[v + 1] += first[v];
+        adj.resize(from.size());
+        VI pos(first.begin(), first.end() - 1);
+        for (int e = 0; e < from.size(); e++) adj[pos[from[e]]++] = e;
+        built = true;
+    }
+
+    COST_INT Reduced(int e) {
+        return cost[e] + pi[from[e]] - pi[to[e]];
+    }
+
+    // Multi-source Dijkstra on the reduced costs.  Stops at t, or at the
+    // first node with a deficit when t == -1, and returns that node (-1 if
+    // it cannot be reached).
+    int Dijkstra(const VI& sources, int t) {
+        PRICING_STAT(MCMF_DIJKSTRAS);
+        for (int i = 0; i < touched.size(); i++) dist[touched[i]] = COST_INF;
+        touched.clear();
+        settled.clear();
+        epoch++;
+        priority_queue<PCI, vector<PCI>, greater<PCI> > heap;
+        for (int i = 0; i < sources.size(); i++) {
+            int s = sources[i];
+            dist[s] = 0;
+            pred[s] = -1;
+            touched.push_back(s);
+            heap.push(PCI(0, s));
+        }
+        int reached = -1;
+        while (!heap.empty()) {
+            PCI top = heap.top();
+            heap.pop();
+            int v = top.second;
+            if (top.first > dist[v]) continue;
+            if (t == -1 ? excess[v] < 0 : v == t) {
+                reached = v;
+                break;
+            }
+            settled.push_back(v);
+            region[v] = epoch;
+            for (int i = first[v]; i < first[v + 1]; i++) {
+                int e = adj[i];
+                if (cap[e] - flow[e] == 0) continue;
+                int w = to[e];
+                COST_INT d = dist[v] + Reduced(e);
+                if (d < dist[w]) {
+                    PRICING_STAT(MCMF_RELAXATIONS);
+                    if (dist[w] == COST_INF) touched.push_back(w);
+                    dist[w] = d;
+                    pred[w] = e;
+                    heap.push(PCI(d, w));
+                }
+            }
         }
+        if (reached == -1) return -1;
+
+        // nodes that were not settled are at least as far as the target,
+        // so lowering the settled ones keeps every reduced cost valid
+        COST_INT D = dist[reached];
+        for (int i = 0; i < settled.size(); i++)
+            pi[settled[i]] += dist[settled[i]] - D;
+        return reached;
+    }
+
+    bool IsTarget(int v, int t) {
+        return t == -1 ? excess[v] < 0 : v == t;
     }
-    
-    FLOW_INT Dijkstra(int s, int t) {
-        fill(found.begin(), found.end(), false);
-        fill(dist.begin(), dist.end(), INF);
-        fill(width.begin(), width.end(), 0);
-        dist[s] = 0;
-        width[s] = INF;
-        
-        while (s != -1) {
-            int best = -1;
-            found[s] = true;
-            for (int k = 0; k < N; k++) {
-                if (found[k]) continue;
-                Relax(s, k, cap[s][k] - flow[s][k], cost[s][k], 1);
-                Relax(s, k, flow[k][s], -cost[k][s], -1);
-                if (best == -1 || dist[k] < dist[best]) best = k;
+
+    bool Levels(const VI& sources, int t) {
+        // breadth first layering of the arcs with zero reduced cost, limited
+        // to the nodes settled by the last Dijkstra and the targets
+        for (int i = 0; i < layered.size(); i++) level[layered[i]] = -1;
+        layered.clear();
+        for (int i = 0; i < sources.size(); i++) {
+            if (t == -1 && excess[sources[i]] <= 0) continue;
+            level[sources[i]] = 0;
+            layered.push_back(sources[i]);
+        }
+        bool found = false;
+        for (int k = 0; k < layered.size(); k++) {
+            int v = layered[k];
+            if (IsTarget(v, t)) {
+                found = true;
+                continue;
+            }
+            if (region[v] != epoch) continue;
+            for (int i = first[v]; i < first[v + 1]; i++) {
+                int e = adj[i];
+                int w = to[e];
+                if (level[w] != -1 || cap[e] - flow[e] == 0 || Reduced(e) != 0) continue;
+                if (region[w] != epoch && !IsTarget(w, t)) continue;
+                level[w] = level[v] + 1;
+                layered.push_back(w);
             }
-            s = best;
         }
-        
-        for (int k = 0; k < N; k++)
-            pi[k] = pi[k] + dist[k] < INF ? pi[k] + dist[k] : INF;
-        return width[t];
+        return found;
     }
-    
+
+    FLOW_INT Augment(int v, int t, FLOW_INT limit) {
+        if (IsTarget(v, t)) {
+            PRICING_STAT(MCMF_AUGMENTATIONS);
+            if (t != -1) return limit;
+            FLOW_INT absorbed = min(limit, -excess[v]);
+            excess[v] += absorbed;
+            return absorbed;
+        }
+        FLOW_INT pushed = 0;
+        for (; current[v] < first[v + 1]; current[v]++) {
+            int e = adj[current[v]];
+            int w = to[e];
+            if (level[w] != level[v] + 1 || cap[e] - flow[e] == 0 || Reduced(e) != 0) continue;
+            FLOW_INT amt = Augment(w, t, min(limit - pushed, cap[e] - flow[e]));
+            PushOnArc(e, amt);
+            pushed += amt;
+            if (pushed == limit) break;
+        }
+        return pushed;
+    }
+
     pair<FLOW_INT, FLOW_INT> GetMaxFlow(int s, int t) {
-        FLOW_INT totflow = 0, totcost = 0;
-        while (FLOW_INT amt = Dijkstra(s, t)) {
-            totflow += amt;
-            for (int x = t; x != s; x = dad[x].first) {
-                if (dad[x].second == 1) {
-                    flow[dad[x].first][x] += amt;
-                    totcost += amt * cost[dad[x].first][x];
-                } else {
-                    flow[x][dad[x].first] -= amt;
-                    totcost -= amt * cost[x][dad[x].first];
+        if (circulation == -1) circulation = AddEdge(t, s, 0, -CIRCULATION_COST);
+        if (!built) Build();
+        Reset();
+        FLOW_INT totflow = 0;
+        VI sources(1, s);
+        while (Dijkstra(sources, t) != -1) {
+            while (Levels(sources, t)) {
+                copy(first.begin(), first.end() - 1, current.begin());
+                totflow += Augment(s, t, INF);
+            }
+        }
+        CloseCirculation(s, t, totflow);
+        return make_pair(totflow, total_cost);
+    }
+
+    void CloseCirculation(int s, int t, FLOW_INT totflow) {
+        // The last Dijkstra touched exactly the nodes reachable from s.  No
+        // residual arc leaves that set, so the potentials of all other nodes
+        // can be raised until the sink -> source arc has zero reduced cost.
+        vector<bool> reachable(N, false);
+        for (int i = 0; i < touched.size(); i++) reachable[touched[i]] = true;
+        COST_INT shift = CIRCULATION_COST - (pi[t] - pi[s]);
+        assert(shift >= 0);
+        for (int v = 0; v < N; v++)
+            if (!reachable[v]) pi[v] += shift;
+        SetEdge(circulation, INF, -CIRCULATION_COST);
+        flow[circulation] = totflow;
+        flow[circulation^1] = -totflow;
+        warm = true;
+    }
+
+    void PushOnArc(int e, FLOW_INT amt) {
+        flow[e] += amt;
+        flow[e^1] -= amt;
+        if ((e|1) != (circulation|1)) total_cost += amt * cost[e];
+    }
+
+    void ChangeEdge(int e, FLOW_INT cap, FLOW_INT cost) {
+        assert(warm);
+        total_cost += flow[e] * (cost - this->cost[e]);
+        SetEdge(e, cap, cost);
+        // saturate or drain the arc so that no residual arc has a
+        // negative reduced cost; the difference is left as excess
+        FLOW_INT target = min(flow[e], cap);
+        COST_INT reduced = Reduced(e);
+        if (reduced < 0) target = cap;
+        if (reduced > 0) target = 0;
+        if (target == flow[e]) return;
+        excess[from[e]] -= target - flow[e];
+        excess[to[e]] += target - flow[e];
+        unbalanced.push_back(from[e]);
+        unbalanced.push_back(to[e]);
+        PushOnArc(e, target - flow[e]);
+    }
+
+    pair<FLOW_INT, FLOW_INT> Reoptimize() {
+        assert(warm);
+        VI sources;
+        while (true) {
+            sort(unbalanced.begin(), unbalanced.end());
+            unbalanced.erase(unique(unbalanced.begin(), unbalanced.end()), unbalanced.end());
+            sources.clear();
+            int n = 0;
+            for (int i = 0; i < unbalanced.size(); i++) {
+                int v = unbalanced[i];
+                if (excess[v] == 0) continue;
+                unbalanced[n++] = v;
+                if (excess[v] > 0) sources.push_back(v);
+            }
+            unbalanced.resize(n);
+            if (sources.empty()) break;
+
+            // route the excesses along shortest paths to the nearest deficits
+            int v = Dijkstra(sources, -1);
+            assert(v != -1);
+            while (Levels(sources, -1)) {
+                copy(first.begin(), first.end() - 1, current.begin());
+                for (int i = 0; i < sources.size(); i++) {
+                    int u = sources[i];
+                    if (excess[u] > 0) excess[u] -= Augment(u, -1, excess[u]);
                 }
             }
+            for (int i = 0; i < touched.size(); i++)
+                if (excess[touched[i]] != 0) unbalanced.push_back(touched[i]);
         }
-        return make_pair(totflow, totcost);
+        return make_pair(flow[circulation], total_cost);
     }
 };
 
-#endif
\ No newline at end of file
+#endif
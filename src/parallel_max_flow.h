@@ -0,0 +1,224 @@
+// Multithreaded push relabel maximum flow after the lock-free algorithm
+// of Hong (2008).  A thread owns the vertex it discharges: it pushes to
+// neighbours with a lower label through its current arc or lifts its own
+// label, and residual capacities and excesses are only changed by atomic
+// adds, so no locks are held on the graph.  Active vertices sit in one
+// work-stealing queue per thread.  Once the relabel work exceeds the size
+// of the graph the threads stop and the labels are recomputed by a level
+// synchronous reverse BFS from the sink run on all threads.  Labels read
+// from other threads may be stale, so the run only ends after such a
+// global relabel finds no active vertex that can still reach the sink.
+// Unlike Hong, a vertex pushes through its current arc to any lower
+// neighbour rather than to its lowest one, so without the global
+// relabels the threads could push excess back and forth; the run
+// relies on that global relabel loop to terminate.
+//
+// Only the flow value is computed: vertices that can no longer reach the
+// sink keep their excess, so afterwards the arcs hold a maximum preflow.
+//
+// INPUT:
+//     - graph, constructed using AddEdge()
+//     - source
+//     - sink
+//     - the thread pool doing the work
+//
+// OUTPUT:
+//     - maximum flow value
+//
+// Capacities can be rewritten with SetEdge() between calls; every
+// GetMaxFlow() starts from zero flow.
+
+#ifndef __PARALLEL_MAX_FLOW__
+#define __PARALLEL_MAX_FLOW__
+
+#include "max_flow.h"
+#include "thread_pool.h"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+using namespace std;
+
+struct ParallelPushRelabel {
+    struct WorkQueue {
+        mutex m;
+        deque<int> q;
+    };
+
+    int N;
+    ThreadPool* pool;
+    vector<int> from, to, cap;       // arc e^1 is the residual of arc e
+    vector<int> first, adj;          // arcs leaving v are adj[first[v]] .. adj[first[v+1]-1]
+    vector<int> current;             // touched only by the thread owning the vertex
+    bool built;
+    vector<atomic<int> > res;        // residual capacity of every arc
+    vector<atomic<LL> > excess;
+    vector<atomic<int> > dist;
+    vector<atomic<bool> > queued;    // active and owned by a queue or a thread
+    vector<WorkQueue> queues;
+    vector<vector<int> > frontier;   // per thread BFS output
+    atomic<int> pending;             // queued or running vertices
+    atomic<long long> work;          // relabel work since the last global relabel
+    atomic<bool> stop;
+
+    ParallelPushRelabel(int N, ThreadPool* pool) :
+    N(N), pool(pool), built(false), excess(N), dist(N), queued(N),
+    queues(pool->size), frontier(pool->size) {}
+
+    int AddEdge(int from, int to, int cap) {
+        int e = this->from.size();
+        this->from.push_back(from); this->to.push_back(to); this->cap.push_back(cap);
+        this->from.push_back(to); this->to.push_back(from); this->cap.push_back(0);
+        built = false;
+        return e;
+    }
+
+    void SetEdge(int e, int cap) {
+        this->cap[e] = cap;
+    }
+
+    void Build() {
+        first.assign(N + 1, 0);
+        for (int e = 0; e < from.size(); e++) first[from[e] + 1]++;
+        for (int v = 0; v < N; v++) first[v + 1] += first[v];
+        adj.resize(from.size());
+        vector<int> pos(first.begin(), first.end() - 1);
+        for (int e = 0; e < from.size(); e++) adj[pos[from[e]]++] = e;
+        res = vector<atomic<int> >(from.size());
+        current.resize(N);
+        built = true;
+    }
+
+    void Enqueue(int v, int worker) {
+        bool expected = false;
+        if (!queued[v].compare_exchange_strong(expected, true)) return;
+        pending++;
+        lock_guard<mutex> lock(queues[worker].m);
+        queues[worker].q.push_back(v);
+    }
+
+    int Pop(int worker) {
+        // newest vertex of our own queue, otherwise the oldest of another
+        for (int k = 0; k < queues.size(); k++) {
+            WorkQueue &Q = queues[(worker + k) % queues.size()];
+            lock_guard<mutex> lock(Q.m);
+            if (Q.q.empty()) continue;
+            int v;
+            if (k == 0) {
+                v = Q.q.back();
+                Q.q.pop_back();
+            } else {
+                v = Q.q.front();
+                Q.q.pop_front();
+            }
+            return v;
+        }
+        return -1;
+    }
+
+    void Discharge(int u, int t, int worker) {
+        while (excess[u] > 0 && dist[u] < N && !stop) {
+            int du = dist[u];
+            for (; current[u] < first[u + 1]; current[u]++) {
+                int e = adj[current[u]];
+                int v = to[e];
+                if (res[e] == 0 || dist[v] >= du) continue;
+                int amt = int(min(LL(excess[u]), LL(res[e])));
+                res[e] -= amt;
+                res[e^1] += amt;
+                excess[u] -= amt;
+                if (excess[v].fetch_add(amt) == 0 && v != t) Enqueue(v, worker);
+                if (excess[u] == 0) return;
+            }
+            int h = 2*N;
+            for (int i = first[u]; i < first[u + 1]; i++) {
+                int e = adj[i];
+                if (res[e] > 0) h = min(h, int(dist[to[e]]));
+            }
+            dist[u] = min(h + 1, N);
+            current[u] = first[u];
+            if ((work += first[u + 1] - first[u]) > N + LL(from.size())) stop = true;
+        }
+    }
+
+    void Run(int t, int worker) {
+        while (!stop) {
+            int u = Pop(worker);
+            if (u == -1) {
+                if (pending == 0) return;
+                this_thread::yield();
+                continue;
+            }
+            Discharge(u, t, worker);
+            queued[u] = false;
+            if (excess[u] > 0 && dist[u] < N && !stop) Enqueue(u, worker);
+            pending--;
+        }
+    }
+
+    void GlobalRelabel(int s, int t) {
+        for (int v = 0; v < N; v++) dist[v] = 2*N;
+        dist[s] = N;
+        dist[t] = 0;
+        vector<int> level(1, t);
+        for (int d = 1; !level.empty(); d++) {
+            int chunk = max(1, int(level.size() / (4 * pool->size)));
+            int chunks = (level.size() + chunk - 1) / chunk;
+            pool->parallelFor(chunks, [&](int c, int worker) {
+                for (int k = c * chunk; k < min(int(level.size()), (c + 1) * chunk); k++) {
+                    int v = level[k];
+                    for (int i = first[v]; i < first[v + 1]; i++) {
+                        int e = adj[i];
+                        int w = to[e];
+                        int unseen = 2*N;
+                        if (res[e^1] > 0 && dist[w] == unseen && dist[w].compare_exchange_strong(unseen, d))
+                            frontier[worker].push_back(w);
+                    }
+                }
+            });
+            level.clear();
+            for (int w = 0; w < frontier.size(); w++) {
+                level.insert(level.end(), frontier[w].begin(), frontier[w].end());
+                frontier[w].clear();
+            }
+        }
+        for (int v = 0; v < N; v++)
+            if (dist[v] == 2*N) dist[v] = N;
+    }
+
+    LL GetMaxFlow(int s, int t) {
+        if (!built) Build();
+        for (int e = 0; e < from.size(); e++) res[e] = cap[e];
+        for (int v = 0; v < N; v++) {
+            excess[v] = 0;
+            queued[v] = false;
+        }
+        for (int i = first[s]; i < first[s + 1]; i++) {
+            int e = adj[i];
+            excess[to[e]] += res[e];
+            res[e^1] += res[e];
+            res[e] = 0;
+        }
+
+        while (true) {
+            GlobalRelabel(s, t);
+            pending = 0;
+            work = 0;
+            stop = false;
+            for (auto& Q : queues) Q.q.clear();
+            for (int v = 0; v < N; v++) {
+                queued[v] = false;
+                current[v] = first[v];
+                if (v != s && v != t && excess[v] > 0 && dist[v] < N) Enqueue(v, v % queues.size());
+            }
+            if (pending == 0) break;
+            pool->parallelFor(pool->size, [&](int i, int worker) { Run(t, worker); });
+        }
+        return excess[t];
+    }
+};
+
+#endif
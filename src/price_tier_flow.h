@@ -0,0 +1,85 @@
+// Exact revenue for networks in which only the arcs into the sink carry
+// a price.  This is the min cost max flow with cost MAX - price on those
+// arcs, but solved tier by tier: the priced arcs are opened in order of
+// decreasing price and the max flow is continued after every tier.  The
+// sink values of a flow network form a polymatroid, so the greedy order
+// is optimal, and augmenting never lowers the flow already routed into
+// the sink by a higher tier.
+//
+// Running time:
+//     one global relabel and one resumed push relabel per distinct price
+//
+// INPUT:
+//     - graph, constructed using AddEdge() and AddPricedEdge(); every
+//       arc into the sink must be a priced one
+//     - source
+//     - sink
+//
+// OUTPUT:
+//     - (maximum flow value, revenue of the most valuable maximum flow)
+//     - The flow of a priced arc is available through PricedFlow().
+
+#ifndef __PRICE_TIER_FLOW__
+#define __PRICE_TIER_FLOW__
+
+#include "max_flow.h"
+
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+struct PriceTierMaxFlow {
+    PushRelabel g;
+    vector<int> arc_from, arc_pos; // priced arc i is g.G[arc_from[i]][arc_pos[i]]
+    vector<int> arc_cap, arc_price;
+
+    PriceTierMaxFlow(int N = 0) : g(N) {}
+
+    void AddEdge(int from, int to, int cap) {
+        g.AddEdge(from, to, cap);
+    }
+
+    int AddPricedEdge(int from, int to, int cap, int price) {
+        arc_from.push_back(from);
+        arc_pos.push_back(g.AddEdge(from, to, 0));
+        arc_cap.push_back(cap);
+        arc_price.push_back(price);
+        return arc_cap.size() - 1;
+    }
+
+    void SetPricedEdge(int i, int cap, int price) {
+        arc_cap[i] = cap;
+        arc_price[i] = price;
+    }
+
+    int PricedFlow(int i) {
+        return g.G[arc_from[i]][arc_pos[i]].flow;
+    }
+
+    pair<LL, LL> GetMaxRevenue(int s, int t) {
+        vector<pair<int, int> > order; // (price, priced arc)
+        for (int i = 0; i < arc_cap.size(); i++) {
+            g.G[arc_from[i]][arc_pos[i]].cap = 0;
+            if (arc_cap[i] > 0) order.push_back(make_pair(arc_price[i], i));
+        }
+        sort(order.rbegin(), order.rend());
+
+        g.GetMaxFlow(s, t);
+        for (int j = 0; j < order.size(); ) {
+            int price = order[j].first;
+            for (; j < order.size() && order[j].first == price; j++) {
+                int i = order[j].second;
+                g.G[arc_from[i]][arc_pos[i]].cap = arc_cap[i];
+            }
+            g.GlobalRelabel(s, t);
+            g.Augment(s, t);
+        }
+
+        LL revenue = 0;
+        for (int i = 0; i < arc_cap.size(); i++) revenue += PricedFlow(i) * arc_price[i];
+        return make_pair(g.FlowOut(s), revenue);
+    }
+};
+
+#endif
@@ -0,0 +1,79 @@
+// Bounded memo of revenues keyed by a Zobrist hash of the pricing: the key
+// is the XOR of one random word per (label, price), so changing the price
+// of one label updates the key in O(1).  The words come from a fixed mixing
+// function rather than a table, so any number of labels is supported.
+// Only the 64 bit key is stored; a collision would return the revenue of
+// another pricing, which is negligible at the sizes used here.
+//
+// Two generations are kept: when the current one holds half of the capacity
+// it becomes the old one and the previous old one is dropped.  A hit in the
+// old generation is moved to the current one, so recently used pricings
+// survive.  Not thread safe.
+
+#ifndef __REVENUE_CACHE__
+#define __REVENUE_CACHE__
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace std;
+
+struct RevenueCache {
+    size_t capacity; // maximum number of entries, 0 disables the cache
+    unordered_map<unsigned long long, int> recent, old;
+    long long hits, misses;
+
+    RevenueCache(size_t capacity = 1 << 18) : capacity(capacity), hits(0), misses(0) {}
+
+    static unsigned long long key(int l, int price) {
+        // splitmix64 of the (label, price) pair
+        unsigned long long z = ((unsigned long long)l << 32 | (unsigned)price) + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    static unsigned long long key(const vector<int>& pricing) {
+        unsigned long long h = 0;
+        for (int l = 0; l < pricing.size(); ++l) {
+            h ^= key(l, pricing[l]);
+        }
+        return h;
+    }
+
+    bool find(unsigned long long h, int& revenue) {
+        auto it = recent.find(h);
+        if (it != recent.end()) {
+            revenue = it->second;
+            hits++;
+            return true;
+        }
+        it = old.find(h);
+        if (it != old.end()) {
+            revenue = it->second;
+            hits++;
+            insert(h, revenue);
+            return true;
+        }
+        misses++;
+        return false;
+    }
+
+    void insert(unsigned long long h, int revenue) {
+        if (capacity == 0) return;
+        if (recent.size() >= max(capacity / 2, size_t(1))) {
+            old.swap(recent);
+            recent.clear();
+        }
+        recent[h] = revenue;
+    }
+
+    void clear() {
+        recent.clear();
+        old.clear();
+        hits = misses = 0;
+    }
+};
+
+#endif
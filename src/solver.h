@@ -1,7 +1,11 @@
 #include "data_generator.h"
 #include "max_flow.h"
 #include "min_cost_flow.h"
+#include "price_tier_flow.h"
 #include "approximate_min_cost_flow.h"
+#include "thread_pool.h"
+#include "revenue_cache.h"
+#include "stats.h"
 
 #include <iostream>
 #include <cmath>
@@ -9,92 +13,314 @@
 #include <assert.h>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <time.h>
 #include <cstring>
+#include <limits>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+// label l shares users with other: p_l >= p_other*af_to and p_other >= p_l*af_from
+struct ArbitrageConstraint {
+    int other;
+    float af_to; // |u_l \cap u_other|/|u_l|
+    float af_from; // |u_l \cap u_other|/|u_other|
+};
+
+// progress of the local search, reported on every improvement and once at the end
+struct SearchProgress {
+    double elapsed; // seconds since the search started
+    long long evaluations; // candidate pricings evaluated so far
+    int round;
+    int revenue; // revenue of the best pricing so far
+    bool done; // last record of the search
+    bool converged; // done and no candidate improves, false if the budget ran out
+};
+
 struct ProblemSolver {
-    vector<User> users;
+    shared_ptr<const UserLabelIndex> users; // shared with the data and aa
     vector<Request> requests;
     int N; // number of buyers;
     int M; // number of users;
     int L; // number of labels
-    int l_size[MAX_LABEL]; // number of users with that label
+    vector<int> l_size; // number of users with that label
+    int K; // number of distinct label sets
+    vector<User> user_classes; // users grouped by their (sorted) label set
+    vector<int> class_size; // number of users sharing that label set
+    
+    // flow graphs over the static class->label->request topology; only the
+    // request->sink arcs depend on the pricing and are rewritten per evaluation
+    int source, sink;
+    MinCostMaxFlow mcmf;
+    PriceTierMaxFlow tiers;
+    vector<int> mcmf_sink_edges; // arc id of request i -> sink
+    vector<int> tier_sink_edges; // priced arc id of request i -> sink
+    vector<vector<int> > label_requests; // indices of the requests on each label
+    vector<int> mcmf_pricing; // pricing of the optimal flow held by mcmf, empty if none
+    vector<MinCostMaxFlow> worker_mcmf; // per thread copies of mcmf for the parallel local search
+    vector<vector<int> > worker_pricing; // pricing held by each copy
 //    vector<pair<int, unsigned short> > edges;
-    float af[MAX_LABEL][MAX_LABEL]; // arbitrage-free matrix
-//    ApproximateAlgorithm aa;
+    vector<vector<ArbitrageConstraint> > af; // arbitrage-free constraints of each label, non-zero overlaps only
+    // af flattened for the bound kernel: constraints of l are bound_first[l] .. bound_first[l+1]-1
+    vector<int> bound_first, bound_other;
+    vector<double> bound_af; // af_to
+    vector<double> bound_inv; // 1/af_from, NaN where af_from is too small to bound anything
+    bool avx2; // bound kernel runs on AVX2
+    vector<double> lower_bound, upper_bound; // price bounds of every label for the current pricing
+    ApproximateAlgorithm aa; // workspace of the approximate revenue, refers to users
+    vector<ApproximateAlgorithm> worker_aa; // per thread copies for the parallel local search
     
     //variable for optimal pricing
     int dfs_revenue;
     vector<int> dfs_pricing;
+    int dfs_subtree; // subtree of dfs_pricing, -1 for the initial pricing
+    vector<vector<int> > dfs_candidates; // tier tops of each label, highest first
+    vector<PriceTierMaxFlow> worker_tiers; // per thread copies of tiers for the exact search
+    
+    // budget of the local search, 0 for none
+    double budget_seconds;
+    long long budget_evaluations;
+    int budget_rounds;
+    function<void(const SearchProgress&)> progress; // called with every progress record, if set
+    
+    // revenues of pricings evaluated before; the approximate one is only valid
+    // for the random rounds and seed of aa, clear it when they change
+    RevenueCache exact_cache, approximate_cache;
     
-    ProblemSolver(const NetworkData& data) {
-        users = data.users;
+    ProblemSolver(const NetworkData& data, ThreadPool* pool=NULL) {
+        users = data.user_index;
         requests = data.requests;
         N = data.N;
         M = data.M;
         L = data.L;
-        memset(l_size, 0, sizeof(l_size));
-        for (const auto& user : users) {
-            for (const auto& l : user) {
-                l_size[l] += 1;
-            }
+        assert(L<=65536); // labels are unsigned short
+        assert(users->L == L);
+        l_size.assign(L, 0);
+        for (int l = 0; l < L; ++l) {
+            l_size[l] = users->labelSize(l);
         }
         
-        assert(L<=1000);
-        
-        _computeArbitrageFreeConstraints();
+        _groupUsersByLabelSet();
+        _buildFlowGraphs();
+        _computeArbitrageFreeConstraints(pool);
+        aa.setParameters(users, requests, vector<int>(L, 0));
+        aa.setRandomRounds(10, data.seed);
+        setSearchBudget(0, 0);
+    }
+    
+    void setSearchBudget(double seconds, long long evaluations, function<void(const SearchProgress&)> progress=nullptr, int rounds=0) {
+        // once the budget runs out the local search returns the best pricing found so far;
+        // it is checked before every candidate, or every batch with a pool, and
+        // rounds caps the number of rounds
+        budget_seconds = seconds;
+        budget_evaluations = evaluations;
+        budget_rounds = rounds;
+        this->progress = progress;
+    }
+    
+    void _groupUsersByLabelSet() {
+        // users with the same label set are interchangeable in the flow graphs,
+        // so each distinct set becomes one node weighted by its multiplicity
+        map<User, int> classes;
+        User labels;
+        for (int i = 0; i < M; ++i) {
+            labels.assign(users->begin(i), users->end(i));
+            sort(labels.begin(), labels.end());
+            classes[labels] += 1;
+        }
+        user_classes.clear();
+        class_size.clear();
+        for (const auto& c : classes) {
+            user_classes.push_back(c.first);
+            class_size.push_back(c.second);
+        }
+        K = user_classes.size();
     }
     
     vector<tuple<int, int, int> > _genearteEdge() {
         // this process already convert the index as:
-        // user k -> k; user set j -> M+j; advertiser i-> M+L+i
+        // user class k -> k; user set j -> K+j; advertiser i-> K+L+i
         vector<tuple<int, int, int> > edges;
         edges.clear();
-        for (int k = 0; k < M; ++k) {
-            for (const auto& l : users[k]) {
-                edges.push_back(tuple<int, int, int>(k, M+l, 1));
+        for (int k = 0; k < K; ++k) {
+            for (const auto& l : user_classes[k]) {
+                edges.push_back(tuple<int, int, int>(k, K+l, class_size[k]));
             }
         }
         
         for (int j = 0; j < N; ++j) {
             int l = get<0>(requests[j]);
-            edges.push_back(tuple<int, int, int>(M+l, M+L+j, l_size[l]));
+            edges.push_back(tuple<int, int, int>(K+l, K+L+j, l_size[l]));
         }
         return edges;
     }
     
-    void _computeArbitrageFreeConstraints() {
+    void _buildFlowGraphs() {
+        source = N + K + L;
+        sink = N + K + L + 1;
+        mcmf = MinCostMaxFlow(K + N + L + 2);
+        tiers = PriceTierMaxFlow(K + N + L + 2);
+        for (int k = 0; k < K; ++k) {
+            mcmf.AddEdge(source, k, class_size[k], 0);
+            tiers.AddEdge(source, k, class_size[k]);
+        }
+        
+        for (const auto& e : _genearteEdge()) {
+            int from = get<0>(e);
+            int to = get<1>(e);
+            int cap = get<2>(e);
+            mcmf.AddEdge(from, to, cap, 0);
+            tiers.AddEdge(from, to, cap);
+        }
+        
+        mcmf_sink_edges.clear();
+        tier_sink_edges.clear();
+        label_requests.assign(L, vector<int>(0));
+        for (int i = 0; i < N; ++i) {
+            mcmf_sink_edges.push_back(mcmf.AddEdge(i+K+L, sink, 0, 0));
+            tier_sink_edges.push_back(tiers.AddPricedEdge(i+K+L, sink, 0, 0));
+            label_requests[get<0>(requests[i])].push_back(i);
+        }
+        mcmf_pricing.clear();
+    }
+    
+    void _computeArbitrageFreeConstraints(ThreadPool* pool=NULL) {
         /*
          p_i|u_i|>=p_j|u_i\cap u_j| --> p_i>=p_j*af[i][j] where af[i][j]=|u_i\cap u_j|/|u_i|,similarly
          p_j[u_j|>=p_i|u_i\cap u_j| --> p_j>=p_i*af[j][i] where af[j][i]=|u_i\cap u_j|/|u_j|
          So p_i is valid iff for any k, p_i>=p_k*af[i][k] and for any k, p_k>=p_i*af[k][i]
          */
         
-        memset(af, 0, sizeof(af));
-        vector<vector<int> > label_user_list(0);
-        for (int i = 0; i < L; ++i) {
-            label_user_list.push_back(vector<int> (0));
+        // common[i]: (j, |u_i \cap u_j|) for every j > i sharing users with i
+        vector<vector<pair<int, int> > > common(L);
+        int words = (M + 63) / 64;
+        double bitset_cost = 0.5 * L * L * words, pair_cost = 0;
+        for (int k = 0; k < K; ++k) {
+            pair_cost += 0.5 * user_classes[k].size() * user_classes[k].size();
         }
-        for (int i = 0; i < users.size(); ++i) {
-            for (const auto& l : users[i]) {
-                label_user_list[l].push_back(i);
+        
+        if (bitset_cost <= pair_cost && (double)L * words * 8 <= (1 << 28)) {
+            // |u_i \cap u_j| is the popcount of the AND of the user bitsets of
+            // labels i and j; the rows are independent and run on the pool
+            vector<unsigned long long> bits((size_t)L * words, 0);
+            for (int l = 0; l < L; ++l) {
+                for (const int* u = users->labelBegin(l); u != users->labelEnd(l); ++u) {
+                    bits[(size_t)l * words + *u / 64] |= 1ULL << (*u % 64);
+                }
+            }
+            bool popcnt = _hasPopcount();
+            _forEachLabel(pool, [&](int i, int worker) {
+                for (int j = i + 1; j < L; ++j) {
+                    const unsigned long long* a = &bits[(size_t)i * words];
+                    const unsigned long long* b = &bits[(size_t)j * words];
+                    int c = popcnt ? _countCommonPopcnt(a, b, words) : _countCommon(a, b, words);
+                    if (c > 0) common[i].push_back(make_pair(j, c));
+                }
+            });
+        } else {
+            // many labels, few per user: add up the label pairs of the user
+            // classes, row i only visits the classes containing label i
+            vector<vector<int> > label_classes(L);
+            for (int k = 0; k < K; ++k) {
+                for (const auto& l : user_classes[k]) {
+                    label_classes[l].push_back(k);
+                }
             }
+            int workers = pool != NULL ? pool->size : 1;
+            vector<vector<int> > counts(workers, vector<int>(L, 0));
+            vector<vector<int> > seen(workers);
+            _forEachLabel(pool, [&](int i, int worker) {
+                vector<int>& count = counts[worker];
+                for (const auto& k : label_classes[i]) {
+                    for (const auto& j : user_classes[k]) {
+                        if (j <= i) continue;
+                        if (count[j] == 0) seen[worker].push_back(j);
+                        count[j] += class_size[k];
+                    }
+                }
+                sort(seen[worker].begin(), seen[worker].end());
+                for (const auto& j : seen[worker]) {
+                    common[i].push_back(make_pair(j, count[j]));
+                    count[j] = 0;
+                }
+                seen[worker].clear();
+            });
         }
         
+        af.assign(L, vector<ArbitrageConstraint>(0));
         for (int i = 0; i < L; ++i) {
-            for (int j = i + 1; j < L; ++j) {
-                vector<int> intersection(0);
-                set_intersection(label_user_list[i].begin(), label_user_list[i].end(),
-                                 label_user_list[j].begin(), label_user_list[j].end(),
-                                 back_inserter(intersection));
-                af[i][j] = intersection.size() * 1.0 / label_user_list[i].size();
-                af[j][i] = intersection.size() * 1.0 / label_user_list[j].size();
+            for (const auto& c : common[i]) {
+                int j = c.first;
+                float af_ij = c.second * 1.0 / l_size[i];
+                float af_ji = c.second * 1.0 / l_size[j];
+                af[i].push_back(ArbitrageConstraint{j, af_ij, af_ji});
+                af[j].push_back(ArbitrageConstraint{i, af_ji, af_ij});
             }
         }
+        
+        bound_first.assign(1, 0);
+        bound_other.clear();
+        bound_af.clear();
+        bound_inv.clear();
+        for (int l = 0; l < L; ++l) {
+            for (const auto& c : af[l]) {
+                bound_other.push_back(c.other);
+                bound_af.push_back(c.af_to);
+                bound_inv.push_back(c.af_from > 1e-6 ? 1.0 / c.af_from : numeric_limits<double>::quiet_NaN());
+            }
+            bound_first.push_back(bound_other.size());
+        }
+        avx2 = _hasAVX2();
+    }
+    
+    void _forEachLabel(ThreadPool* pool, const function<void(int, int)>& fn) {
+        if (pool != NULL) {
+            pool->parallelFor(L, fn);
+        } else {
+            for (int i = 0; i < L; ++i) {
+                fn(i, 0);
+            }
+        }
+    }
+    
+    static int _countCommon(const unsigned long long* a, const unsigned long long* b, int words) {
+        int common = 0;
+        for (int w = 0; w < words; ++w) {
+            common += __builtin_popcountll(a[w] & b[w]);
+        }
+        return common;
+    }
+    
+#if defined(__x86_64__) || defined(__i386__)
+    // the same loop compiled for the popcnt instruction, used when the cpu has it
+    __attribute__((target("popcnt")))
+    static int _countCommonPopcnt(const unsigned long long* a, const unsigned long long* b, int words) {
+        int common = 0;
+        for (int w = 0; w < words; ++w) {
+            common += __builtin_popcountll(a[w] & b[w]);
+        }
+        return common;
     }
     
+    static bool _hasPopcount() {
+        return __builtin_cpu_supports("popcnt");
+    }
+#else
+    static int _countCommonPopcnt(const unsigned long long* a, const unsigned long long* b, int words) {
+        return _countCommon(a, b, words);
+    }
+    
+    static bool _hasPopcount() {
+        return false;
+    }
+#endif
+    
     bool _isUniform(const vector<int>& pricing) {
         for (int i = 0; i < pricing.size() - 1; ++i) {
             if (pricing[i] != pricing[i+1]) {
@@ -119,24 +345,60 @@ struct ProblemSolver {
     }
     
     pair<int, int> findOptimalUniformPrice() {
-        set<int> prices;
-        prices.clear();
-        for (int i = 0; i < N; ++i) {
-            int v = get<2>(requests[i]);
-            prices.insert(v);
-        }
+        vector<tuple<int, int, int> > curve = sweepUniformPrices();
         int best_revenue = -1, best_price = -1;
-        for (set<int>::iterator it = prices.begin(); it != prices.end(); it++) {
-            int revenue = _getRevenueForUniformPricing(*it);
+        for (int i = curve.size() - 1; i >= 0; --i) {
+            int price = get<0>(curve[i]);
+            int revenue = get<2>(curve[i]);
             if (revenue > best_revenue) {
                 best_revenue = revenue;
-                best_price = *it;
+                best_price = price;
             }
         }
         return make_pair(best_revenue, best_price);
     }
+    
+    vector<tuple<int, int, int> > sweepUniformPrices() {
+        // (price, flow, revenue) for every distinct valuation, from the highest
+        // price to the lowest.  The flow runs on the reversed graph (sink ->
+        // requests -> labels -> classes -> source), where lowering the price
+        // only opens arcs out of its source, so one push-relabel state is
+        // carried through the whole sweep.
+        PushRelabel g(K+N+L+2);
+        for (int k = 0; k < K; ++k) {
+            g.AddEdge(k, source, class_size[k]);
+        }
+        for (const auto& e : _genearteEdge()) {
+            g.AddEdge(get<1>(e), get<0>(e), get<2>(e));
+        }
+        vector<pair<int, int> > order(0); // (valuation, request)
+        vector<int> arcs(0);
+        for (int i = 0; i < N; ++i) {
+            arcs.push_back(g.AddEdge(sink, i+K+L, 0));
+            order.push_back(make_pair(get<2>(requests[i]), i));
+        }
+        sort(order.rbegin(), order.rend());
+        
+        vector<tuple<int, int, int> > curve(0);
+        g.GetMaxFlow(sink, source);
+        for (int j = 0; j < order.size(); ) {
+            int price = order[j].first;
+            for (; j < order.size() && order[j].first == price; ++j) {
+                int i = order[j].second;
+                g.G[sink][arcs[i]].cap = get<1>(requests[i]);
+            }
+            int flow = g.Augment(sink, source);
+            curve.push_back(tuple<int, int, int>(price, flow, flow * price));
+        }
+        return curve;
+    }
 
-    pair<int, vector<int> > findLocallyOptimalNonuiformPricing(bool use_random=0, bool include_detail=1) {
+    pair<int, vector<int> > findLocallyOptimalNonuiformPricing(bool use_random=0, bool include_detail=1, ThreadPool* pool=NULL) {
+        // With a pool the candidates of several consecutive labels are evaluated
+        // at once against the current pricing and then committed in label order
+        // as in the sequential search; once a label changes, the results of the
+        // labels after it are dropped and evaluated again.  The outcome does not
+        // depend on the number of threads.
         vector<set<int> > valuations(0);
         for (int i = 0; i < L; ++i) {
             valuations.push_back(set<int> ());
@@ -154,144 +416,589 @@ struct ProblemSolver {
         for (int l = 0; l < L; ++l) {
             pricing.push_back(r.second);
         }
+        if (!use_random) {
+            // candidates are evaluated by repricing this solution one label at a time
+            _getRevenueByMinCostFlow(pricing);
+            if (pool != NULL) {
+                worker_mcmf.assign(pool->size, mcmf);
+                worker_pricing.assign(pool->size, mcmf_pricing);
+            }
+        } else if (pool != NULL) {
+            worker_aa.assign(pool->size, aa);
+            for (auto& w : worker_aa) {
+                w.pool = NULL; // the pool is already busy with the candidates
+            }
+        }
         bool changed = true;
+        vector<int> repriced(0); // labels whose price changed in this round
         
         int round = 0;
         if (include_detail) cout << round << ":" << revenue;
         
-        while (changed) {
+        RevenueCache& cache = use_random ? approximate_cache : exact_cache;
+        unsigned long long hash = RevenueCache::key(pricing); // of the current pricing
+        
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        long long evaluations = 0;
+        bool exhausted = false;
+        auto elapsed = [&]() {
+            return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        };
+        auto outOfBudget = [&]() {
+            return (budget_evaluations > 0 && evaluations >= budget_evaluations) ||
+                   (budget_seconds > 0 && elapsed() >= budget_seconds);
+        };
+        auto report = [&](bool done) {
+            if (progress) progress(SearchProgress{elapsed(), evaluations, round, revenue, done, done && !exhausted});
+        };
+        
+        while (changed && !exhausted) {
+            if (budget_rounds > 0 && round == budget_rounds) {
+                exhausted = true;
+                break;
+            }
             round++;
             changed = false;
-            vector<pair<double, double> > bounds(0);
-            for (int l = 0; l < L; ++l) {
-                bounds.push_back(_computePriceLowerAndUpperBound(l, pricing));
+            PRICING_STAT(LS_ROUNDS);
+#ifdef PRICING_STATS
+            double round_start = elapsed();
+#endif
+            // bounds are taken at the start of the round, only the
+            // neighbours of the labels repriced last round are recomputed
+            if (round == 1) {
+                _computePriceBounds(pricing);
+            } else {
+                _updatePriceBounds(pricing, repriced);
             }
-            for (int l = 0; l < L; ++l) {
+            repriced.clear();
+            int enumerated = 0; // labels whose candidates were listed in this round, for the stats
+            for (int l = 0; pool != NULL && l < L; ) {
+                if (outOfBudget()) {
+                    exhausted = true;
+                    break;
+                }
+                vector<pair<int, int> > batch(0); // (label, candidate price)
+                int end = l;
+                while (end < L && (end == l || batch.size() < 2 * pool->size)) {
+                    for (const auto& v : valuations[end]) {
+                        if (v == pricing[end]) continue;
+                        if (v < lower_bound[end] || v > upper_bound[end]) {
+                            // labels after an accepted candidate are listed again
+                            if (end >= enumerated) PRICING_STAT(LS_SKIPPED_BY_BOUNDS);
+                            continue;
+                        }
+                        batch.push_back(make_pair(end, v));
+                    }
+                    end++;
+                }
+                enumerated = max(enumerated, end);
+                vector<int> results(batch.size());
+                vector<unsigned long long> keys(0);
+                vector<int> misses(0); // candidates not in the cache
+                for (int i = 0; i < batch.size(); ++i) {
+                    int l = batch[i].first;
+                    keys.push_back(hash ^ RevenueCache::key(l, pricing[l]) ^ RevenueCache::key(l, batch[i].second));
+                    if (!cache.find(keys[i], results[i])) misses.push_back(i);
+                }
+                pool->parallelFor(misses.size(), [&](int k, int worker) {
+                    int i = misses[k];
+                    results[i] = _evaluateCandidate(batch[i].first, batch[i].second, pricing, use_random, worker);
+                });
+                for (const auto& i : misses) {
+                    cache.insert(keys[i], results[i]);
+                }
+                evaluations += batch.size();
+                PRICING_STAT_ADD(LS_CANDIDATES, batch.size());
+                l = end;
+                for (int i = 0; i < batch.size() && batch[i].first < l; ++i) {
+                    if (results[i] > revenue) {
+                        revenue = results[i];
+                        changed = true;
+                        hash = keys[i];
+                        pricing[batch[i].first] = batch[i].second;
+                        repriced.push_back(batch[i].first);
+                        PRICING_STAT(LS_ACCEPTED);
+                        l = batch[i].first + 1;
+                        if (include_detail) cout << " " << round << ":" << results[i];
+                        report(false);
+                    }
+                }
+            }
+            for (int l = 0; pool == NULL && l < L && !exhausted; ++l) {
                 vector<int> prcing_l = pricing;
                 for (set<int>::iterator it = valuations[l].begin(); it != valuations[l].end(); it++) {
                     int v = *it;
-                    if (v == pricing[l] || v < bounds[l].first || v > bounds[l].second) continue;
+                    if (v == pricing[l]) continue;
+                    if (v < lower_bound[l] || v > upper_bound[l]) {
+                        PRICING_STAT(LS_SKIPPED_BY_BOUNDS);
+                        continue;
+                    }
+                    if (outOfBudget()) {
+                        exhausted = true;
+                        break;
+                    }
                     prcing_l = pricing;
                     prcing_l[l] = v;
-                    int new_revenue = use_random ? _getApproximateRevenueForNonuniformPricing(prcing_l) : _getRevenueForNonuniformPricing(prcing_l);
+                    unsigned long long key = hash ^ RevenueCache::key(l, pricing[l]) ^ RevenueCache::key(l, v);
+                    int new_revenue;
+                    if (!cache.find(key, new_revenue)) {
+                        new_revenue = use_random ? _getApproximateRevenueForNonuniformPricing(prcing_l, aa) : _repriceLabel(l, v);
+                        cache.insert(key, new_revenue);
+                    }
+                    evaluations++;
+                    PRICING_STAT(LS_CANDIDATES);
                     if (new_revenue > revenue) {
                         revenue = new_revenue;
                         changed = true;
+                        hash = key;
                         pricing[l] = v;
+                        repriced.push_back(l);
+                        PRICING_STAT(LS_ACCEPTED);
                         if (include_detail) cout << " " << round << ":" << new_revenue;
+                        report(false);
                     }
                 }
+                if (!use_random && mcmf_pricing[l] != pricing[l]) {
+                    _repriceLabel(l, pricing[l]);
+                }
             }
+            PRICING_STAT_ROUND(elapsed() - round_start);
         }
         if (include_detail) cout << endl;
+        report(true);
         return make_pair(revenue, pricing);
     }
     
-    pair<int, vector<int> > findOptimalPricingByDFS() {
-        int P[MAX_LABEL];
-        dfs_revenue = 0;
-        dfs_pricing.clear();
-        _DFSPricing(0, P);
+    pair<int, vector<int> > findOptimalPricingByDFS(ThreadPool* pool=NULL) {
+        /*
+         Branch and bound over the labels in order.  Each label is given a
+         tier, the requests it sells to: its price lies in (v', v] for
+         consecutive candidates v' < v among its valuations and MAX_VALUATION.
+         With the tiers fixed the revenue does not decrease when a price rises,
+         and the arbitrage-free pricings below the tier tops are closed under
+         the componentwise maximum, so the best pricing of the tiers is the
+         highest arbitrage-free one below the tops (_highestPricing); the
+         tiers are infeasible if a price in it falls to its v'.  A price
+         capped by another label need not be a valuation, which is why the
+         tops alone are not enough.  A node is pruned when the revenue of that
+         pricing, computed with the labels without a tier at MAX_VALUATION and
+         their requests paying their own valuation, does not beat the best
+         pricing so far, which starts from the uniform optimum and the local
+         search.  The subtrees below the first labels are searched in
+         parallel; a tie goes to the earlier subtree, so the result is the
+         first best pricing in the sequential order for any number of threads.
+         */
+        _candidatePrices();
+        
+        pair<int, int> r = findOptimalUniformPrice();
+        dfs_revenue = r.first;
+        dfs_pricing.assign(L, r.second);
+        dfs_subtree = -1;
+        // only the result of the local search is used, its progress is not reported
+        function<void(const SearchProgress&)> report = progress;
+        progress = nullptr;
+        pair<int, vector<int> > local = findLocallyOptimalNonuiformPricing(0, 0);
+        progress = report;
+        if (local.first > dfs_revenue && _isArbitrageFree(L, &local.second[0])) {
+            dfs_revenue = local.first;
+            dfs_pricing = local.second;
+        }
+        
+        int workers = pool != NULL ? pool->size : 1;
+        vector<vector<int> > prefixes(1, vector<int>(0)); // tier tops of the first labels of every subtree
+        vector<int> Q(0), lowered(0);
+        while (workers > 1 && prefixes.size() < 4 * workers && prefixes[0].size() < L) {
+            int l = prefixes[0].size();
+            vector<vector<int> > next(0);
+            for (auto& P : prefixes) {
+                P.push_back(0);
+                for (const auto& v : dfs_candidates[l]) {
+                    P[l] = v;
+                    Q.assign(L, MAX_VALUATION);
+                    if (_highestPricing(0, l + 1, &P[0], Q, lowered)) next.push_back(P);
+                }
+            }
+            prefixes.swap(next);
+            if (prefixes.empty()) return make_pair(dfs_revenue, dfs_pricing);
+        }
+        
+        mutex best;
+        worker_tiers.assign(workers, tiers);
+        for (auto& g : worker_tiers) {
+            for (int l = 0; l < L; ++l) {
+                _setDFSPrice(g, l, -1);
+            }
+        }
+        auto subtree = [&](int i, int worker) {
+            int l = prefixes[i].size();
+            vector<int> P = prefixes[i], Q(L, MAX_VALUATION), lowered(0);
+            P.resize(L, 0);
+            _highestPricing(0, l, &P[0], Q, lowered); // feasible, the prefix was kept
+            for (int j = 0; j < l; ++j) {
+                _setDFSPrice(worker_tiers[worker], j, Q[j]);
+            }
+            _DFSPricing(l, &P[0], Q, i, worker, best);
+            for (int j = 0; j < l; ++j) {
+                _setDFSPrice(worker_tiers[worker], j, -1);
+            }
+        };
+        if (pool != NULL) {
+            pool->parallelFor(prefixes.size(), subtree);
+        } else {
+            subtree(0, 0);
+        }
         return make_pair(dfs_revenue, dfs_pricing);
     }
     
     int _getRevenueForNonuniformPricing(const vector<int>& pricing) {
-        MinCostMaxFlow g(M + N + L + 2);
-        int s, t; //source & sink
-        s = N + M + L;
-        t = N + M + L + 1;
-        for (int i = 0; i < M; ++i) {
-            g.AddEdge(s, i, 1, 0);
+        unsigned long long key = RevenueCache::key(pricing);
+        int revenue;
+        if (!exact_cache.find(key, revenue)) {
+            revenue = _getRevenueByPriceTiers(pricing);
+            exact_cache.insert(key, revenue);
+        }
+        return revenue;
+    }
+    
+    vector<int> evaluateBatch(const vector<vector<int> >& pricings, bool exact=true, ThreadPool* pool=NULL) {
+        // revenues of all pricings, in order, exact or approximate as
+        // _getRevenueForNonuniformPricing() and _getApproximateRevenueForNonuniformPricing().
+        // Pricings in the cache or repeated in the batch are evaluated once;
+        // the rest run on the pool, each worker on its own copy of the graph
+        // or approximate algorithm built for this instance.
+        RevenueCache& cache = exact ? exact_cache : approximate_cache;
+        vector<int> revenues(pricings.size());
+        vector<unsigned long long> keys(0);
+        vector<int> misses(0); // first index of every pricing to evaluate
+        unordered_map<unsigned long long, int> pending; // key -> index in misses
+        for (int i = 0; i < pricings.size(); ++i) {
+            assert(pricings[i].size() == L);
+            keys.push_back(RevenueCache::key(pricings[i]));
+            if (pending.count(keys[i]) || cache.find(keys[i], revenues[i])) continue;
+            pending[keys[i]] = misses.size();
+            misses.push_back(i);
         }
         
-        for (const auto& e : _genearteEdge()) {
-            int from = get<0>(e);
-            int to = get<1>(e);
-            int cap = get<2>(e);
-            g.AddEdge(from, to, cap, 0);
+        int workers = pool != NULL ? max(1, min(pool->size, (int)misses.size())) : 1;
+        if (exact && workers > 1) {
+            worker_tiers.assign(workers, tiers);
+        } else if (!exact && workers > 1) {
+            worker_aa.assign(workers, aa);
+            for (auto& w : worker_aa) {
+                w.pool = NULL; // the pool is already busy with the pricings
+            }
+        }
+        auto evaluate = [&](int k, int worker) {
+            const vector<int>& pricing = pricings[misses[k]];
+            if (workers == 1) {
+                revenues[misses[k]] = exact ? _getRevenueByPriceTiers(pricing) : _getApproximateRevenueForNonuniformPricing(pricing, aa);
+            } else {
+                revenues[misses[k]] = exact ? _getRevenueByPriceTiers(pricing, worker_tiers[worker]) :
+                    _getApproximateRevenueForNonuniformPricing(pricing, worker_aa[worker]);
+            }
+        };
+        if (workers > 1) {
+            pool->parallelFor(misses.size(), evaluate);
+        } else {
+            for (int k = 0; k < misses.size(); ++k) {
+                evaluate(k, 0);
+            }
         }
         
+        for (const auto& i : misses) {
+            cache.insert(keys[i], revenues[i]);
+        }
+        for (int i = 0; i < pricings.size(); ++i) {
+            auto it = pending.find(keys[i]);
+            if (it != pending.end()) revenues[i] = revenues[misses[it->second]];
+        }
+        return revenues;
+    }
+    
+    int _getRevenueByPriceTiers(const vector<int>& pricing) {
+        return _getRevenueByPriceTiers(pricing, tiers);
+    }
+    
+    int _getRevenueByPriceTiers(const vector<int>& pricing, PriceTierMaxFlow& g) {
+        for (int i = 0; i < N; ++i) {
+            int l = get<0>(requests[i]);
+            int d = get<1>(requests[i]);
+            int v = get<2>(requests[i]);
+            g.SetPricedEdge(tier_sink_edges[i], v >= pricing[l] ? d : 0, pricing[l]);
+        }
+        return g.GetMaxRevenue(source, sink).second;
+    }
+    
+    int _getRevenueByMinCostFlow(const vector<int>& pricing) {
         for (int i = 0; i < N; ++i) {
             int l = get<0>(requests[i]);
             int d = get<1>(requests[i]);
             int v = get<2>(requests[i]);
             if (v >= pricing[l]) {
-                g.AddEdge(i+M+L, t, d, MAX_VALUATION - pricing[l]);
+                mcmf.SetEdge(mcmf_sink_edges[i], d, MAX_VALUATION - pricing[l]);
+            } else {
+                mcmf.SetEdge(mcmf_sink_edges[i], 0, 0);
             }
         }
-        pair<int, int> r = g.GetMaxFlow(s,t);
+        pair<int, int> r = mcmf.GetMaxFlow(source, sink);
+        mcmf_pricing = pricing;
         int flow = r.first;
         int cost = r.second;
         return MAX_VALUATION*flow - cost;
     }
     
-    int _getRevenueForUniformPricing(int price) {
-        PushRelabel g(M+N+L+2);
-        int s, t; //source & sink
-        s = N + M + L;
-        t = N + M + L + 1;
-        for (int i = 0; i < M; ++i) {
-            g.AddEdge(s, i, 1);
-        }
-        
-        for (const auto& e : _genearteEdge()) {
-            int from = get<0>(e);
-            int to = get<1>(e);
-            int cap = get<2>(e);
-            g.AddEdge(from, to, cap);
-        }
-        for (int i = 0; i < N; ++i) {
+    int _repriceLabel(int l, int price) {
+        // re-optimizes the flow of the last _getRevenueByMinCostFlow() after
+        // pricing[l] changed; only the sink arcs of label l are touched
+        return _repriceLabel(l, price, mcmf, mcmf_pricing);
+    }
+    
+    int _repriceLabel(int l, int price, MinCostMaxFlow& g, vector<int>& g_pricing) {
+        assert(!g_pricing.empty());
+        for (const auto& i : label_requests[l]) {
             int d = get<1>(requests[i]);
             int v = get<2>(requests[i]);
             if (v >= price) {
-                g.AddEdge(i+M+L, t, d);
+                g.ChangeEdge(mcmf_sink_edges[i], d, MAX_VALUATION - price);
+            } else {
+                g.ChangeEdge(mcmf_sink_edges[i], 0, 0);
             }
         }
-        return g.GetMaxFlow(s,t) * price;
+        g_pricing[l] = price;
+        pair<int, int> r = g.Reoptimize();
+        int flow = r.first;
+        int cost = r.second;
+        return MAX_VALUATION*flow - cost;
+    }
+    
+    int _evaluateCandidate(int l, int price, const vector<int>& pricing, bool use_random, int worker) {
+        // revenue of pricing with label l set to price, on the worker's own copy
+        if (use_random) {
+            vector<int> pricing_l = pricing;
+            pricing_l[l] = price;
+            return _getApproximateRevenueForNonuniformPricing(pricing_l, worker_aa[worker]);
+        }
+        for (int j = 0; j < L; ++j) {
+            if (j != l && worker_pricing[worker][j] != pricing[j]) {
+                _repriceLabel(j, pricing[j], worker_mcmf[worker], worker_pricing[worker]);
+            }
+        }
+        return _repriceLabel(l, price, worker_mcmf[worker], worker_pricing[worker]);
+    }
+    
+    int _getRevenueForUniformPricing(int price) {
+        return _getRevenueForNonuniformPricing(vector<int>(L, price));
     }
     
     int _getApproximateRevenueForNonuniformPricing(const vector<int>& pricing) {
-        ApproximateAlgorithm aa(users, requests, pricing);
-        return aa.computeRevenue();
+        unsigned long long key = RevenueCache::key(pricing);
+        int revenue;
+        if (!approximate_cache.find(key, revenue)) {
+            revenue = _getApproximateRevenueForNonuniformPricing(pricing, aa);
+            approximate_cache.insert(key, revenue);
+        }
+        return revenue;
+    }
+    
+    int _getApproximateRevenueForNonuniformPricing(const vector<int>& pricing, ApproximateAlgorithm& workspace) {
+        workspace.setPricing(pricing);
+        return workspace.computeRevenue();
     }
     
     pair<double, double> _computePriceLowerAndUpperBound(int l, const vector<int>& pricing) {
         double lower = 1;
         double upper = MAX_VALUATION;
-        for (int i = 0; i < L; ++i) {
-            if (i == l) continue;
-            lower = max((double)af[l][i]*pricing[i], lower);
-            if (af[i][l] > 1e-6) {
-                upper = min((double)pricing[i]/af[i][l], upper);
-            }
+        if (avx2) {
+            _boundsAVX2(l, &pricing[0], lower, upper);
+        } else {
+            _boundsScalar(l, bound_first[l], &pricing[0], lower, upper);
         }
         return make_pair(lower, upper);
     }
     
-    void _DFSPricing(int l, int P[MAX_LABEL]) {
-        if (l == L) {
-            vector<int> pricing(P, P + L);
-            const auto& r = _getRevenueForNonuniformPricing(pricing);
-            if (r > dfs_revenue) {
-                dfs_revenue = r;
-                dfs_pricing = pricing;
+    void _computePriceBounds(const vector<int>& pricing) {
+        lower_bound.resize(L);
+        upper_bound.resize(L);
+        for (int l = 0; l < L; ++l) {
+            tie(lower_bound[l], upper_bound[l]) = _computePriceLowerAndUpperBound(l, pricing);
+        }
+    }
+    
+    void _updatePriceBounds(const vector<int>& pricing, const vector<int>& repriced) {
+        // the bounds of l only depend on the prices of the labels sharing users with l
+        vector<bool> stale(L, false);
+        for (const auto& l : repriced) {
+            for (const auto& c : af[l]) {
+                stale[c.other] = true;
             }
-        } else {
-            for (int i = 1; i <= MAX_VALUATION; ++i) {
-                P[l] = i;
-                if (_isArbitrageFree(l+1, P)) {
-                    _DFSPricing(l+1, P);
-                }
+        }
+        for (int l = 0; l < L; ++l) {
+            if (stale[l]) {
+                tie(lower_bound[l], upper_bound[l]) = _computePriceLowerAndUpperBound(l, pricing);
             }
         }
-        
     }
     
-    bool _isArbitrageFree(int l, int P[MAX_LABEL]) {
+    void _boundsScalar(int l, int j, const int* pricing, double& lower, double& upper) {
+        // constraints j .. of label l; the comparisons are those of maxpd/minpd,
+        // so a NaN reciprocal is skipped
+        for (; j < bound_first[l + 1]; ++j) {
+            double p = pricing[bound_other[j]];
+            double x = bound_af[j] * p;
+            if (x > lower) lower = x;
+            double y = p * bound_inv[j];
+            if (y < upper) upper = y;
+        }
+    }
+    
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("avx2")))
+    void _boundsAVX2(int l, const int* pricing, double& lower, double& upper) {
+        __m256d lo = _mm256_set1_pd(lower), up = _mm256_set1_pd(upper);
+        int j = bound_first[l];
+        for (; j + 4 <= bound_first[l + 1]; j += 4) {
+            __m128i others = _mm_loadu_si128((const __m128i*)&bound_other[j]);
+            __m256d p = _mm256_cvtepi32_pd(_mm_i32gather_epi32(pricing, others, 4));
+            lo = _mm256_max_pd(_mm256_mul_pd(_mm256_loadu_pd(&bound_af[j]), p), lo);
+            up = _mm256_min_pd(_mm256_mul_pd(p, _mm256_loadu_pd(&bound_inv[j])), up);
+        }
+        double lanes_lo[4], lanes_up[4];
+        _mm256_storeu_pd(lanes_lo, lo);
+        _mm256_storeu_pd(lanes_up, up);
+        for (int k = 0; k < 4; ++k) {
+            if (lanes_lo[k] > lower) lower = lanes_lo[k];
+            if (lanes_up[k] < upper) upper = lanes_up[k];
+        }
+        _boundsScalar(l, j, pricing, lower, upper);
+    }
+    
+    static bool _hasAVX2() {
+        return __builtin_cpu_supports("avx2");
+    }
+#else
+    void _boundsAVX2(int l, const int* pricing, double& lower, double& upper) {
+        _boundsScalar(l, bound_first[l], pricing, lower, upper);
+    }
+    
+    static bool _hasAVX2() {
+        return false;
+    }
+#endif
+    
+    void _DFSPricing(int l, int* P, const vector<int>& Q, int subtree, int worker, mutex& best) {
+        // labels 0..l-1 have the tier tops P and are priced at Q, the highest
+        // arbitrage-free pricing below them, in worker_tiers[worker]
+        PriceTierMaxFlow& g = worker_tiers[worker];
+        // with all labels priced the bound is the revenue itself
+        int bound = g.GetMaxRevenue(source, sink).second;
+        bool better;
+        {
+            lock_guard<mutex> lock(best);
+            better = bound > dfs_revenue || (bound == dfs_revenue && subtree < dfs_subtree);
+            if (better && l == L) {
+                dfs_revenue = bound;
+                dfs_pricing = Q;
+                dfs_subtree = subtree;
+            }
+        }
+        if (!better || l == L) return;
+        vector<int> R(0), lowered(0);
+        for (int k = 0; k < dfs_candidates[l].size(); ++k) {
+            P[l] = dfs_candidates[l][k];
+            R = Q;
+            lowered.clear();
+            if (!_highestPricing(l, l + 1, P, R, lowered)) continue;
+            // only the labels whose price fell change in the tier graph
+            for (const auto& j : lowered) {
+                if (j < l) _setDFSPrice(g, j, R[j]);
+            }
+            _setDFSPrice(g, l, R[l]);
+            _DFSPricing(l+1, P, R, subtree, worker, best);
+            for (const auto& j : lowered) {
+                if (j < l) _setDFSPrice(g, j, Q[j]);
+            }
+            _setDFSPrice(g, l, -1);
+        }
+    }
+    
+    void _candidatePrices() {
+        // dfs_candidates: the distinct valuations of every label and MAX_VALUATION
+        dfs_candidates.assign(L, vector<int>(1, MAX_VALUATION));
+        for (const auto& request : requests) {
+            dfs_candidates[get<0>(request)].push_back(get<2>(request));
+        }
+        for (auto& vs : dfs_candidates) {
+            sort(vs.rbegin(), vs.rend());
+            vs.erase(unique(vs.begin(), vs.end()), vs.end());
+        }
+    }
+    
+    bool _highestPricing(int from, int l, const int* P, vector<int>& Q, vector<int>& lowered) {
+        // Q: on entry the highest arbitrage-free pricing with labels
+        // 0..from-1 at most their tier tops P and the others at most
+        // MAX_VALUATION, on return the same for labels 0..l-1.  Prices only
+        // fall, so only the constraints of the labels from..l-1 and of the
+        // labels lowered after them are checked, lowering prices to their
+        // caps until none is violated.  lowered: the labels whose price fell,
+        // possibly repeated.  False if a label of 0..l-1 falls out of its
+        // tier or any price below 1.
+        vector<int> pending(0);
+        for (int j = from; j < l; ++j) {
+            if (P[j] < Q[j]) {
+                Q[j] = P[j];
+                lowered.push_back(j);
+                pending.push_back(j);
+            }
+        }
+        while (!pending.empty()) {
+            int j = pending.back();
+            pending.pop_back();
+            for (const auto& c : af[j]) {
+                // Q[j] >= Q[m] * c.af_to, compared as in _isArbitrageFree
+                int m = c.other;
+                if (!(Q[j] < Q[m] * c.af_to)) continue;
+                int q = min(Q[m] - 1, int(Q[j] / (double)c.af_to));
+                while (q > 0 && Q[j] < q * c.af_to) q--;
+                while (q + 1 < Q[m] && !(Q[j] < (q + 1) * c.af_to)) q++;
+                if (q < 1) return 0;
+                Q[m] = q;
+                lowered.push_back(m);
+                pending.push_back(m);
+            }
+        }
+        auto outOfTier = [&](int j) {
+            const vector<int>& tops = dfs_candidates[j];
+            auto next = std::upper_bound(tops.begin(), tops.end(), P[j], greater<int>());
+            return next != tops.end() && Q[j] <= *next;
+        };
+        for (int j = from; j < l; ++j) {
+            if (outOfTier(j)) return 0;
+        }
+        for (const auto& j : lowered) {
+            if (j < from && outOfTier(j)) return 0;
+        }
+        return 1;
+    }
+    
+    void _setDFSPrice(PriceTierMaxFlow& g, int l, int price) {
+        // price < 0: label l is unpriced and every request pays its own valuation
+        for (const auto& i : label_requests[l]) {
+            int d = get<1>(requests[i]);
+            int v = get<2>(requests[i]);
+            if (price < 0) {
+                g.SetPricedEdge(tier_sink_edges[i], d, v);
+            } else {
+                g.SetPricedEdge(tier_sink_edges[i], v >= price ? d : 0, price);
+            }
+        }
+    }
+    
+    bool _isArbitrageFree(int l, int* P) {
         for (int i = 0; i < l; ++i) {
-            for (int j = 0; j < l; ++j) {
-                if (i == j) continue;
-                if (P[i] < P[j] * af[i][j] || P[j] < P[i] * af[j][i])
+            for (const auto& c : af[i]) {
+                int j = c.other;
+                if (j >= l) continue;
+                if (P[i] < P[j] * c.af_to || P[j] < P[i] * c.af_from)
                     return 0;
             }
         }
@@ -0,0 +1,157 @@
+// Counters of the hot loops of the flow solvers, the approximate algorithm
+// and the local search, compiled in with -DPRICING_STATS.  Without it the
+// PRICING_STAT macros expand to nothing, and printStats() only reports that
+// the counters are disabled.
+//
+// Every thread counts into its own thread_local block, so counting is a
+// plain add; a block is folded into the totals when its thread exits.
+// printStats() and resetStats() read the blocks of the live threads and
+// must be called while no solver is running, e.g. at the end of a run.
+
+#ifndef __STATS__
+#define __STATS__
+
+#include <iostream>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+using namespace std;
+
+enum StatCounter {
+    PR_PUSHES,              // PushRelabel
+    PR_RELABELS,
+    PR_GAPS,
+    PR_DISCHARGES,
+    MCMF_DIJKSTRAS,         // MinCostMaxFlow
+    MCMF_AUGMENTATIONS,     // paths reaching a target
+    MCMF_RELAXATIONS,       // distance decreases
+    AA_PASSES,              // ApproximateAlgorithm greedy passes
+    AA_USERS_SCANNED,
+    LS_CANDIDATES,          // local search, evaluated incl. cache hits; with a pool
+                            // the batch after an accepted candidate counts again
+    LS_SKIPPED_BY_BOUNDS,   // once per round, as in the sequential search
+    LS_ACCEPTED,
+    LS_ROUNDS,
+    STAT_COUNTERS
+};
+
+const char* const STAT_NAMES[STAT_COUNTERS] = {
+    "pushes", "relabels", "gaps", "discharges",
+    "dijkstras", "augmentations", "relaxations",
+    "passes", "users_scanned",
+    "candidates", "skipped_by_bounds", "accepted", "rounds",
+};
+
+#ifdef PRICING_STATS
+
+struct ThreadStats;
+
+struct StatsRegistry {
+    mutex m;
+    long long retired[STAT_COUNTERS]; // of the threads that have exited
+    vector<ThreadStats*> live;
+    vector<double> round_seconds; // of every local search round, in order
+
+    StatsRegistry() {
+        fill(retired, retired + STAT_COUNTERS, 0);
+    }
+};
+
+inline StatsRegistry& statsRegistry() {
+    static StatsRegistry registry;
+    return registry;
+}
+
+struct ThreadStats {
+    long long count[STAT_COUNTERS];
+
+    ThreadStats() {
+        fill(count, count + STAT_COUNTERS, 0);
+        StatsRegistry& r = statsRegistry();
+        lock_guard<mutex> lock(r.m);
+        r.live.push_back(this);
+    }
+
+    ~ThreadStats() {
+        StatsRegistry& r = statsRegistry();
+        lock_guard<mutex> lock(r.m);
+        for (int c = 0; c < STAT_COUNTERS; ++c) {
+            r.retired[c] += count[c];
+        }
+        r.live.erase(find(r.live.begin(), r.live.end(), this));
+    }
+};
+
+inline ThreadStats& threadStats() {
+    static thread_local ThreadStats stats;
+    return stats;
+}
+
+inline void recordRound(double seconds) {
+    StatsRegistry& r = statsRegistry();
+    lock_guard<mutex> lock(r.m);
+    r.round_seconds.push_back(seconds);
+}
+
+#define PRICING_STAT_ADD(counter, n) (threadStats().count[counter] += (n))
+#define PRICING_STAT(counter) PRICING_STAT_ADD(counter, 1)
+#define PRICING_STAT_ROUND(seconds) recordRound(seconds)
+
+inline void resetStats() {
+    StatsRegistry& r = statsRegistry();
+    lock_guard<mutex> lock(r.m);
+    fill(r.retired, r.retired + STAT_COUNTERS, 0);
+    for (const auto& t : r.live) {
+        fill(t->count, t->count + STAT_COUNTERS, 0);
+    }
+    r.round_seconds.clear();
+}
+
+inline void printStats(ostream& out) {
+    // one JSON object, the counters grouped by engine
+    StatsRegistry& r = statsRegistry();
+    lock_guard<mutex> lock(r.m);
+    long long total[STAT_COUNTERS];
+    copy(r.retired, r.retired + STAT_COUNTERS, total);
+    for (const auto& t : r.live) {
+        for (int c = 0; c < STAT_COUNTERS; ++c) {
+            total[c] += t->count[c];
+        }
+    }
+    const char* groups[] = {"push_relabel", "min_cost_flow", "approximate", "local_search"};
+    const int group_end[] = {MCMF_DIJKSTRAS, AA_PASSES, LS_CANDIDATES, STAT_COUNTERS};
+    out << "{\"enabled\": true";
+    for (int g = 0, c = 0; g < 4; ++g) {
+        out << ", \"" << groups[g] << "\": {";
+        for (int first = c; c < group_end[g]; ++c) {
+            out << (c == first ? "" : ", ") << "\"" << STAT_NAMES[c] << "\": " << total[c];
+        }
+        if (g == 3) {
+            out << ", \"round_seconds\": [";
+            for (int i = 0; i < r.round_seconds.size(); ++i) {
+                out << (i == 0 ? "" : ", ") << r.round_seconds[i];
+            }
+            out << "]";
+        }
+        out << "}";
+    }
+    out << "}" << endl;
+}
+
+#else
+
+#define PRICING_STAT_ADD(counter, n) ((void)0)
+#define PRICING_STAT(counter) ((void)0)
+#define PRICING_STAT_ROUND(seconds) ((void)0)
+
+inline void resetStats() {
+}
+
+inline void printStats(ostream& out) {
+    out << "{\"enabled\": false}" << endl;
+}
+
+#endif
+
+#endif
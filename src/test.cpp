@@ -1,6 +1,10 @@
 #include "data_generator.h"
 #include "max_flow.h"
 #include "min_cost_flow.h"
+#include "parallel_max_flow.h"
+#include "thread_pool.h"
+#include "approximate_min_cost_flow.h"
+#include "solver.h"
 
 #include <iostream>
 #include <cmath>
@@ -10,9 +14,7 @@
 #include <time.h>
 #include <set>
 
-int main() {
-    srand(time(NULL));
-    
+void compareFlowSolvers() {
     int N = 1102;
     int s = 0, t = N - 1;
     
@@ -54,5 +56,465 @@ int main() {
     cout << r.first << " " << r.second << endl;
     float diff ((float)t2-(float)t1);
     cout<< diff/1000000 << endl;
+}
+
+int ungroupedRevenue(const NetworkData& data, const vector<int>& pricing) {
+    // min cost flow on the graph with one node per user:
+    // source -> user i -> label -> request -> sink
+    int M = data.M, L = data.L, N = data.N;
+    int source = M + L + N, sink = source + 1;
+    MinCostMaxFlow g(M + L + N + 2);
+    vector<int> l_size(L, 0);
+    for (int i = 0; i < M; ++i) {
+        g.AddEdge(source, i, 1, 0);
+        for (const unsigned short* l = data.user_index->begin(i); l != data.user_index->end(i); ++l) {
+            g.AddEdge(i, M + *l, 1, 0);
+            l_size[*l]++;
+        }
+    }
+    for (int j = 0; j < N; ++j) {
+        int l = get<0>(data.requests[j]);
+        int d = get<1>(data.requests[j]);
+        int v = get<2>(data.requests[j]);
+        g.AddEdge(M + l, M + L + j, l_size[l], 0);
+        g.AddEdge(M + L + j, sink, v >= pricing[l] ? d : 0, MAX_VALUATION - pricing[l]);
+    }
+    pair<int, int> r = g.GetMaxFlow(source, sink);
+    return MAX_VALUATION * r.first - r.second;
+}
+
+void checkUserClasses(NetworkData& data) {
+    // grouping users with the same label set keeps every revenue
+    ProblemSolver ps(data);
+    assert(ps.K <= data.M);
+    for (int k = 0; k < 20; ++k) {
+        vector<int> pricing(0);
+        for (int i = 0; i < data.L; ++i) {
+            pricing.push_back(k < 10 ? k * MAX_VALUATION / 10 + 1 : rand()%MAX_VALUATION+1);
+        }
+        assert(ps._getRevenueByPriceTiers(pricing) == ungroupedRevenue(data, pricing));
+    }
+}
+
+void checkUserClasses() {
+    NetworkData data;
+    data.loadFromFile("../data/data_2.txt");
+    assert(data.user_index->M == data.M);
+    checkUserClasses(data);
+    for (int k = 0; k < 5; ++k) {
+        data.init(50, 200, 10, 4, rand());
+        checkUserClasses(data);
+        data.init(100, 1000, 50, 20, rand());
+        checkUserClasses(data);
+    }
+    cout << "user classes match one node per user" << endl;
+}
+
+void checkIncrementalReprice(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    ProblemSolver ps(data);
+    ProblemSolver cold(data);
+    vector<int> pricing(0);
+    for (int i = 0; i < L; ++i) {
+        pricing.push_back(rand()%MAX_VALUATION+1);
+    }
+    ps._getRevenueByMinCostFlow(pricing);
+    for (int k = 0; k < 200; ++k) {
+        int l = rand()%L;
+        pricing[l] = rand()%MAX_VALUATION+1;
+        int r1 = ps._repriceLabel(l, pricing[l]);
+        int r2 = cold._getRevenueForNonuniformPricing(pricing);
+        assert(r1 == r2);
+    }
+    cout << "incremental reprice matches full solve" << endl;
+}
+
+void checkPriceTiersAgainstMinCostFlow(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    ProblemSolver ps(data);
+    clock_t tier_time = 0, mcmf_time = 0;
+    for (int k = 0; k < 100; ++k) {
+        vector<int> pricing(0);
+        for (int i = 0; i < L; ++i) {
+            pricing.push_back(rand()%(MAX_VALUATION+1));
+        }
+        clock_t t1 = clock();
+        int r1 = ps._getRevenueForNonuniformPricing(pricing);
+        clock_t t2 = clock();
+        int r2 = ps._getRevenueByMinCostFlow(pricing);
+        clock_t t3 = clock();
+        assert(r1 == r2);
+        tier_time += t2 - t1;
+        mcmf_time += t3 - t2;
+    }
+    cout << "price tiers match min cost flow, " << tier_time * 1.0 / CLOCKS_PER_SEC << "s vs ";
+    cout << mcmf_time * 1.0 / CLOCKS_PER_SEC << "s" << endl;
+}
+
+void checkUniformSweep(int N, int M, int L, int L_user) {
+    for (int k = 0; k < 10; ++k) {
+        NetworkData data;
+        data.init(N, M, L, L_user, rand());
+        ProblemSolver ps(data);
+        for (const auto& point : ps.sweepUniformPrices()) {
+            int price = get<0>(point);
+            PushRelabel g(ps.K + N + L + 2);
+            for (int k = 0; k < ps.K; ++k) {
+                g.AddEdge(ps.source, k, ps.class_size[k]);
+            }
+            for (const auto& e : ps._genearteEdge()) {
+                g.AddEdge(get<0>(e), get<1>(e), get<2>(e));
+            }
+            for (int i = 0; i < N; ++i) {
+                g.AddEdge(ps.K+L+i, ps.sink, get<2>(ps.requests[i]) >= price ? get<1>(ps.requests[i]) : 0);
+            }
+            int flow = g.GetMaxFlow(ps.source, ps.sink);
+            assert(get<1>(point) == flow && get<2>(point) == flow * price);
+        }
+    }
+    cout << "uniform sweep matches a max flow per price" << endl;
+}
+
+void compareMaxFlowEngines(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    ProblemSolver ps(data);
+    int n = ps.K + N + L + 2;
+    PushRelabel fifo(n), highest(n, true);
+    for (int k = 0; k < ps.K; ++k) {
+        fifo.AddEdge(ps.source, k, ps.class_size[k]);
+        highest.AddEdge(ps.source, k, ps.class_size[k]);
+    }
+    for (const auto& e : ps._genearteEdge()) {
+        fifo.AddEdge(get<0>(e), get<1>(e), get<2>(e));
+        highest.AddEdge(get<0>(e), get<1>(e), get<2>(e));
+    }
+    vector<int> arcs(0);
+    for (int i = 0; i < N; ++i) {
+        arcs.push_back(fifo.AddEdge(ps.K+L+i, ps.sink, 0));
+        highest.AddEdge(ps.K+L+i, ps.sink, 0);
+    }
+    clock_t fifo_time = 0, highest_time = 0;
+    for (int k = 0; k < 20; ++k) {
+        int price = rand()%MAX_VALUATION+1;
+        for (int i = 0; i < N; ++i) {
+            int d = get<2>(ps.requests[i]) >= price ? get<1>(ps.requests[i]) : 0;
+            fifo.G[ps.K+L+i][arcs[i]].cap = d;
+            highest.G[ps.K+L+i][arcs[i]].cap = d;
+        }
+        clock_t t1 = clock();
+        int f1 = fifo.GetMaxFlow(ps.source, ps.sink);
+        clock_t t2 = clock();
+        int f2 = highest.GetMaxFlow(ps.source, ps.sink);
+        clock_t t3 = clock();
+        assert(f1 == f2);
+        fifo_time += t2 - t1;
+        highest_time += t3 - t2;
+    }
+    cout << "highest label matches fifo, " << highest_time * 1.0 / CLOCKS_PER_SEC << "s vs ";
+    cout << fifo_time * 1.0 / CLOCKS_PER_SEC << "s" << endl;
+}
+
+void checkParallelMaxFlow(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    ProblemSolver ps(data);
+    int n = ps.K + N + L + 2;
+    int price = rand()%MAX_VALUATION+1;
+    PushRelabel g(n);
+    vector<tuple<int, int, int> > edges = ps._genearteEdge();
+    for (int k = 0; k < ps.K; ++k) {
+        edges.push_back(tuple<int, int, int>(ps.source, k, ps.class_size[k]));
+    }
+    for (int i = 0; i < N; ++i) {
+        int d = get<2>(ps.requests[i]) >= price ? get<1>(ps.requests[i]) : 0;
+        edges.push_back(tuple<int, int, int>(ps.K+L+i, ps.sink, d));
+    }
+    for (const auto& e : edges) {
+        g.AddEdge(get<0>(e), get<1>(e), get<2>(e));
+    }
+    int f1 = g.GetMaxFlow(ps.source, ps.sink);
+    for (int threads = 1; threads <= 4; ++threads) {
+        ThreadPool pool(threads);
+        ParallelPushRelabel pg(n, &pool);
+        for (const auto& e : edges) {
+            pg.AddEdge(get<0>(e), get<1>(e), get<2>(e));
+        }
+        int f2 = pg.GetMaxFlow(ps.source, ps.sink);
+        assert(f1 == f2);
+    }
+    cout << "parallel push relabel matches sequential" << endl;
+}
+
+void checkParallelLocalSearch(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    ProblemSolver ps(data);
+    clock_t t1 = clock();
+    pair<int, vector<int> > r1 = ps.findLocallyOptimalNonuiformPricing(0, 0);
+    clock_t t2 = clock();
+    for (int threads = 2; threads <= 4; ++threads) {
+        ThreadPool pool(threads);
+        pair<int, vector<int> > r2 = ps.findLocallyOptimalNonuiformPricing(0, 0, &pool);
+        assert(r1 == r2);
+    }
+    cout << "parallel local search matches sequential, " << (t2 - t1) * 1.0 / CLOCKS_PER_SEC << "s" << endl;
+}
+
+void checkParallelRandomRounds(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    vector<int> pricing(0);
+    for (int i = 0; i < L; ++i) {
+        pricing.push_back(rand()%MAX_VALUATION+1);
+    }
+    ApproximateAlgorithm aa(data, pricing);
+    assert(aa.computeRevenue() == ApproximateAlgorithm(data, pricing).computeRevenue()); // seeded by the instance
+    ProblemSolver ps1(data), ps2(data);
+    assert(ps1.findLocallyOptimalNonuiformPricing(1, 0) == ps2.findLocallyOptimalNonuiformPricing(1, 0));
+    aa.setRandomRounds(16, 42);
+    int r1 = aa.computeRevenue();
+    for (int threads = 1; threads <= 4; ++threads) {
+        ThreadPool pool(threads);
+        aa.setRandomRounds(16, 42, &pool);
+        assert(aa.computeRevenue() == r1);
+    }
+    cout << "parallel random rounds match sequential" << endl;
+}
+
+void checkExactSearch(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    ProblemSolver ps(data);
+    clock_t t1 = clock();
+    pair<int, vector<int> > r1 = ps.findOptimalPricingByDFS();
+    clock_t t2 = clock();
+    assert(r1.first >= ps.findLocallyOptimalNonuiformPricing(0, 0).first);
+    assert(ps._isArbitrageFree(L, &r1.second[0]));
+    assert(ps._getRevenueForNonuniformPricing(r1.second) == r1.first);
+    ThreadPool pool(4);
+    assert(ps.findOptimalPricingByDFS(&pool).first == r1.first);
+    cout << "exact search beats local search, " << (t2 - t1) * 1.0 / CLOCKS_PER_SEC << "s" << endl;
+}
+
+NetworkData tinyNetwork(int N, int M, int L) {
+    // random users with any non-empty set of labels, unlike init(); every
+    // label has a request
+    NetworkData data;
+    data.N = N;
+    data.M = M;
+    data.L = L;
+    for (int i = 0; i < N; ++i) {
+        data.requests.push_back(Request(i < L ? i : rand()%L, rand()%4+1, rand()%MAX_VALUATION+1));
+    }
+    vector<User> users(0);
+    for (int i = 0; i < M; ++i) {
+        int mask = rand()%((1 << L) - 1) + 1;
+        User user(0);
+        for (int l = 0; l < L; ++l) {
+            if (mask >> l & 1) user.push_back(l);
+        }
+        users.push_back(user);
+    }
+    data.user_index = make_shared<UserLabelIndex>(users, L);
+    return data;
+}
+
+void checkExactSearchByEnumeration(int instances) {
+    // every arbitrage-free pricing of two labels, and of three labels on a
+    // grid of prices, which the exact search must reach
+    for (int k = 0; k < instances; ++k) {
+        int L = k % 2 == 0 ? 2 : 3;
+        NetworkData data = tinyNetwork(L + rand()%3, rand()%10+2, L);
+        ProblemSolver ps(data);
+        int step = L == 2 ? 1 : MAX_VALUATION / 50;
+        int best = 0;
+        vector<int> P(L, step);
+        while (true) {
+            if (ps._isArbitrageFree(L, &P[0])) best = max(best, ps._getRevenueByPriceTiers(P));
+            int l = 0;
+            for (; l < L && P[l] + step > MAX_VALUATION; ++l) P[l] = step;
+            if (l == L) break;
+            P[l] += step;
+        }
+        pair<int, vector<int> > r = ps.findOptimalPricingByDFS();
+        assert(ps._isArbitrageFree(L, &r.second[0]));
+        assert(ps._getRevenueByPriceTiers(r.second) == r.first);
+        assert(L == 2 ? r.first == best : r.first >= best);
+        // ties go to the first pricing in the sequential order
+        ThreadPool pool(3);
+        assert(ps.findOptimalPricingByDFS(&pool) == r);
+    }
+    cout << "exact search matches enumeration" << endl;
+}
+
+void checkSearchBudget(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    ProblemSolver ps(data);
+    vector<SearchProgress> records(0);
+    ps.setSearchBudget(0, 0, [&](const SearchProgress& p) { records.push_back(p); });
+    pair<int, vector<int> > r1 = ps.findLocallyOptimalNonuiformPricing(0, 0);
+    assert(records.back().done && records.back().converged && records.back().revenue == r1.first);
+    long long budget = records.back().evaluations / 2;
+    records.clear();
+    ps.setSearchBudget(0, budget, [&](const SearchProgress& p) { records.push_back(p); });
+    pair<int, vector<int> > r2 = ps.findLocallyOptimalNonuiformPricing(0, 0);
+    assert(records.back().done && !records.back().converged && records.back().evaluations == budget);
+    assert(r2.first <= r1.first && r2.first == ps._getRevenueForNonuniformPricing(r2.second));
+    for (int i = 1; i < records.size(); ++i) {
+        assert(records[i].revenue >= records[i-1].revenue);
+    }
+    cout << "budgeted search stops after " << budget << " evaluations at " << r2.first << " of " << r1.first << endl;
+}
+
+void checkRevenueCache(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    ProblemSolver ps(data);
+    pair<int, vector<int> > r1 = ps.findLocallyOptimalNonuiformPricing(0, 0);
+    long long misses = ps.exact_cache.misses;
+    pair<int, vector<int> > r2 = ps.findLocallyOptimalNonuiformPricing(0, 0);
+    assert(r1 == r2 && ps.exact_cache.misses == misses);
+    assert(ps._getRevenueForNonuniformPricing(r1.second) == ps._getRevenueByPriceTiers(r1.second));
+    cout << "revenue cache: " << ps.exact_cache.hits << " hits, " << ps.exact_cache.misses << " misses" << endl;
+}
+
+void checkBinaryFormat(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    data.saveToBinaryFile("network_test.bin");
+    NetworkData binary;
+    binary.loadFromBinaryFile("network_test.bin");
+    assert(binary.requests == data.requests);
+    assert(binary.user_index->label_users.empty()); // built on first use
+    for (int i = 0; i < M; ++i) {
+        assert(binary.user_index->size(i) == data.user_index->size(i));
+        assert(equal(data.user_index->begin(i), data.user_index->end(i), binary.user_index->begin(i)));
+    }
+    vector<int> pricing(0);
+    for (int i = 0; i < L; ++i) {
+        pricing.push_back(rand()%MAX_VALUATION+1);
+    }
+    ProblemSolver ps(data), ps2(binary);
+    assert(ps._getRevenueForNonuniformPricing(pricing) == ps2._getRevenueForNonuniformPricing(pricing));
+    
+    // a truncated or foreign file is an error, not an out of bounds read
+    ifstream fin("network_test.bin", ios::binary);
+    string bytes((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+    fin.close();
+    vector<string> broken(0);
+    broken.push_back(bytes.substr(0, bytes.size() - 1));
+    broken.push_back(bytes.substr(0, sizeof(BinaryHeader) + 10));
+    broken.push_back("not a network, not a network, not a network");
+    broken.push_back(bytes);
+    broken.back()[bytes.size() - 1] = 0x7f; // label out of range
+    for (const auto& b : broken) {
+        ofstream fout("network_test.bin", ios::binary);
+        fout << b;
+        fout.close();
+        bool failed = false;
+        try {
+            NetworkData bad;
+            bad.loadFromBinaryFile("network_test.bin");
+        } catch (const runtime_error& e) {
+            failed = true;
+        }
+        assert(failed);
+    }
+    remove("network_test.bin");
+    cout << "binary file reads back the same network" << endl;
+}
+
+void checkSeededGenerator(int N, int M, int L, int L_user) {
+    // streams must not be shifted copies of each other
+    for (int stream = 0; stream < 100; ++stream) {
+        SplitMix64 a(42, stream), b(42, stream + 1);
+        a.next();
+        int same = 0;
+        for (int k = 0; k < 1000; ++k) {
+            same += a.next() == b.next();
+        }
+        assert(same == 0);
+    }
+    NetworkData a, b, c;
+    a.init(N, M, L, L_user, 42);
+    ThreadPool pool(4);
+    b.init(N, M, L, L_user, 42, &pool);
+    c.generateToBinaryFile("network_test.bin", N, M, L, L_user, 42, &pool);
+    c.loadFromBinaryFile("network_test.bin");
+    remove("network_test.bin");
+    const UserLabelIndex& u = *a.user_index;
+    for (const NetworkData* d : {&b, &c}) {
+        assert(d->requests == a.requests);
+        assert(equal(u.first, u.first + M + 1, d->user_index->first));
+        assert(equal(u.labels, u.labels + u.first[M], d->user_index->labels));
+    }
+    for (int i = 0; i < M; ++i) {
+        set<int> labels(u.begin(i), u.end(i));
+        assert(labels.size() == u.size(i) && *labels.begin() == 0 && *labels.rbegin() < L);
+    }
+    int same_size = 0; // adjacent users of independent streams, about M / L_user
+    for (int i = 0; i + 1 < M; ++i) {
+        same_size += u.size(i) == u.size(i + 1);
+    }
+    assert(same_size < 2 * M / L_user);
+    cout << "seeded generator is independent of the thread count" << endl;
+}
+
+void checkBatchEvaluation(int N, int M, int L, int L_user) {
+    NetworkData data;
+    data.init(N, M, L, L_user);
+    ProblemSolver ps(data), single(data);
+    ThreadPool pool(4);
+    vector<vector<int> > pricings(0);
+    for (int j = 0; j < 40; ++j) {
+        vector<int> pricing(0);
+        for (int i = 0; i < L; ++i) {
+            pricing.push_back(rand()%MAX_VALUATION+1);
+        }
+        pricings.push_back(pricing);
+    }
+    pricings.push_back(pricings[0]);
+    for (int exact = 0; exact < 2; ++exact) {
+        vector<int> revenues = ps.evaluateBatch(pricings, exact, &pool);
+        ProblemSolver serial(data); // with empty caches
+        assert(revenues == serial.evaluateBatch(pricings, exact));
+        assert(revenues == ps.evaluateBatch(pricings, exact)); // from the cache
+        for (int j = 0; j < pricings.size(); ++j) {
+            int revenue = exact ? single._getRevenueByPriceTiers(pricings[j]) :
+                single._getApproximateRevenueForNonuniformPricing(pricings[j], single.aa);
+            assert(revenues[j] == revenue);
+        }
+    }
+    cout << "batch evaluation matches single evaluations" << endl;
+}
+
+int main() {
+    srand(time(NULL));
     
-}
\ No newline at end of file
+    compareFlowSolvers();
+    checkUserClasses();
+    checkIncrementalReprice(50, 200, 10, 4);
+    checkIncrementalReprice(100, 1000, 50, 20);
+    checkPriceTiersAgainstMinCostFlow(50, 200, 10, 4); // op
+    checkPriceTiersAgainstMinCostFlow(100, 1000, 50, 20); // exp2
+    checkUniformSweep(50, 200, 10, 4);
+    checkUniformSweep(100, 1000, 50, 20);
+    compareMaxFlowEngines(100, 1000, 50, 20);
+    compareMaxFlowEngines(1000, 100000, 200, 20);
+    checkParallelMaxFlow(100, 1000, 50, 20);
+    checkParallelMaxFlow(1000, 100000, 200, 20);
+    checkParallelLocalSearch(50, 200, 10, 4);
+    checkParallelLocalSearch(100, 1000, 50, 20);
+    checkParallelRandomRounds(100, 1000, 50, 20);
+    checkExactSearch(50, 200, 10, 4); // op
+    checkExactSearchByEnumeration(20);
+    checkSearchBudget(100, 1000, 50, 20);
+    checkRevenueCache(100, 1000, 50, 20);
+    checkBinaryFormat(100, 1000, 50, 20);
+    checkSeededGenerator(100, 20000, 50, 20);
+    checkBatchEvaluation(100, 1000, 50, 20);
+}
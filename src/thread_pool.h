@@ -0,0 +1,95 @@
+// A fixed set of worker threads shared by the parallel parts of the
+// solver.  parallelFor(n, fn) calls fn(i, worker) for every i in [0, n)
+// and returns when all calls are done; worker is in [0, size) and no two
+// calls running at the same time get the same worker, so it can index
+// per-thread scratch space.  The calling thread takes part as worker 0,
+// so a pool of size 1 runs everything inline.  Calls to parallelFor()
+// must not be nested or made from two threads at once.
+
+#ifndef __THREAD_POOL__
+#define __THREAD_POOL__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+using namespace std;
+
+struct ThreadPool {
+    int size;
+    vector<thread> workers;
+    mutex m;
+    condition_variable wake, finished;
+    const function<void(int, int)>* job;
+    int n; // number of indices of the current job
+    atomic<int> next; // next index to hand out
+    int generation; // number of jobs started
+    int running; // helper threads still working on the current job
+    bool quit;
+
+    ThreadPool(int size = 0) : job(NULL), n(0), next(0), generation(0), running(0), quit(false) {
+        if (size <= 0) size = max(1, int(thread::hardware_concurrency()));
+        this->size = size;
+        for (int w = 1; w < size; ++w) {
+            workers.push_back(thread(&ThreadPool::_loop, this, w));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(m);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    void parallelFor(int n, const function<void(int, int)>& fn) {
+        if (size == 1 || n <= 1) {
+            for (int i = 0; i < n; ++i) {
+                fn(i, 0);
+            }
+            return;
+        }
+        {
+            lock_guard<mutex> lock(m);
+            job = &fn;
+            this->n = n;
+            next = 0;
+            running = size - 1;
+            generation++;
+        }
+        wake.notify_all();
+        _work(0);
+        unique_lock<mutex> lock(m);
+        finished.wait(lock, [this] { return running == 0; });
+        job = NULL;
+    }
+
+    void _work(int worker) {
+        for (int i = next++; i < n; i = next++) {
+            (*job)(i, worker);
+        }
+    }
+
+    void _loop(int worker) {
+        int seen = 0;
+        unique_lock<mutex> lock(m);
+        while (true) {
+            wake.wait(lock, [&] { return quit || generation != seen; });
+            if (quit) return;
+            seen = generation;
+            lock.unlock();
+            _work(worker);
+            lock.lock();
+            if (--running == 0) finished.notify_one();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,148 @@
+// Labels of all users in CSR layout: the labels of user i are
+// labels[first[i]] .. labels[first[i+1]-1].  The arrays either live in a
+// memory mapped binary file (see NetworkData::loadFromBinaryFile) or in the
+// vectors owned by the index, so users are read without one heap vector
+// each.  The transposed label -> users lists take 4 bytes per entry on the
+// heap, so they are only built on the first call of a label*() accessor,
+// e.g. not for converting or summing up a mapped file.  The index is
+// immutable once built and shared through shared_ptr by the data, the
+// solver and the approximate algorithm.
+
+#ifndef __USER_LABEL_INDEX__
+#define __USER_LABEL_INDEX__
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+struct MappedFile {
+    const char* data;
+    size_t size;
+
+    MappedFile(const string& file_name) {
+        // throws runtime_error if the file cannot be mapped or is empty
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("cannot open " + file_name);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            throw runtime_error("cannot read " + file_name + " or it is empty");
+        }
+        size = st.st_size;
+        void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) throw runtime_error("cannot map " + file_name);
+        data = (const char*)p;
+    }
+
+    ~MappedFile() {
+        munmap((void*)data, size);
+    }
+};
+
+struct UserLabelIndex {
+    int M; // number of users
+    int L; // number of labels
+    const unsigned long long* first;
+    const unsigned short* labels;
+    vector<unsigned long long> first_storage; // used when not mapped
+    vector<unsigned short> label_storage;
+    shared_ptr<MappedFile> file; // keeps the mapping alive
+    // transposed: the users of label l are label_users[label_first[l]] .. label_users[label_first[l+1]-1]
+    mutable vector<unsigned long long> label_first;
+    mutable vector<int> label_users;
+    mutable once_flag label_users_built;
+
+    template <class UserList>
+    UserLabelIndex(const UserList& users, int L) : L(L) {
+        M = users.size();
+        first_storage.assign(1, 0);
+        for (const auto& user : users) {
+            label_storage.insert(label_storage.end(), user.begin(), user.end());
+            first_storage.push_back(label_storage.size());
+        }
+        first = first_storage.data();
+        labels = label_storage.data();
+    }
+
+    UserLabelIndex(int L, vector<unsigned long long>& first_storage, vector<unsigned short>& label_storage) : L(L) {
+        // takes over the arrays
+        M = first_storage.size() - 1;
+        this->first_storage.swap(first_storage);
+        this->label_storage.swap(label_storage);
+        first = this->first_storage.data();
+        labels = this->label_storage.data();
+    }
+
+    UserLabelIndex(shared_ptr<MappedFile> file, int M, int L, const unsigned long long* first, const unsigned short* labels) :
+    M(M), L(L), first(first), labels(labels), file(file) {
+    }
+
+    // copies would point into the storage of the original
+    UserLabelIndex(const UserLabelIndex&) = delete;
+    UserLabelIndex& operator=(const UserLabelIndex&) = delete;
+
+    void _buildLabelUsers() const {
+        label_first.assign(L + 1, 0);
+        for (unsigned long long i = 0; i < first[M]; ++i) {
+            assert(labels[i] < L);
+            label_first[labels[i] + 1]++;
+        }
+        for (int l = 0; l < L; ++l) {
+            label_first[l + 1] += label_first[l];
+        }
+        label_users.resize(first[M]);
+        vector<unsigned long long> pos(label_first.begin(), label_first.end() - 1);
+        for (int u = 0; u < M; ++u) {
+            for (unsigned long long i = first[u]; i < first[u + 1]; ++i) {
+                label_users[pos[labels[i]]++] = u;
+            }
+        }
+    }
+
+    int size(int i) const {
+        return first[i + 1] - first[i];
+    }
+
+    const unsigned short* begin(int i) const {
+        return labels + first[i];
+    }
+
+    const unsigned short* end(int i) const {
+        return labels + first[i + 1];
+    }
+
+    const vector<unsigned long long>& labelFirst() const {
+        // label_first, building the transposed lists if needed
+        call_once(label_users_built, &UserLabelIndex::_buildLabelUsers, this);
+        return label_first;
+    }
+
+    const vector<int>& labelUsers() const {
+        call_once(label_users_built, &UserLabelIndex::_buildLabelUsers, this);
+        return label_users;
+    }
+
+    int labelSize(int l) const {
+        return labelFirst()[l + 1] - label_first[l];
+    }
+
+    const int* labelBegin(int l) const {
+        return labelUsers().data() + label_first[l];
+    }
+
+    const int* labelEnd(int l) const {
+        return labelUsers().data() + label_first[l + 1];
+    }
+};
+
+#endif